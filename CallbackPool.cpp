@@ -0,0 +1,97 @@
+#include "CallbackPool.h"
+#include "RpcLog.h"
+
+#include <algorithm>
+#include <exception>
+
+CallbackPool::CallbackPool(const char* logPrefix, size_t queueCapacity): logPrefix(logPrefix), queue(queueCapacity)
+{
+    queued.store(0);
+}
+
+CallbackPool::~CallbackPool()
+{
+    Stop();
+}
+
+void CallbackPool::Start(int threadCount)
+{
+    for (int i = 0; i < std::max(threadCount, 1); ++i)
+        workers.emplace_back(&CallbackPool::Worker, this);
+}
+
+void CallbackPool::Stop()
+{
+    // An empty task tells one worker to exit once it gets that far. Workers
+    // take the overflow list only once the queue is empty, so the empty tasks
+    // go at its end rather than into a queue cell freed up meanwhile.
+    {
+        std::lock_guard<std::mutex> overflowLock(overflowMutex);
+        for (size_t i = 0; i < workers.size(); ++i)
+            overflow.push_back(Task());
+    }
+    queued.fetch_add(int(workers.size()), std::memory_order_release);
+    queued.notify_all();
+
+    for (std::thread& worker : workers)
+        worker.join();
+    workers.clear();
+}
+
+void CallbackPool::Post(Task task)
+{
+    if (!queue.TryPush(task))
+    {
+        std::lock_guard<std::mutex> overflowLock(overflowMutex);
+        if (overflow.empty())
+            RPC_LOG_DEBUG("%s Task queue is full; overflowing", logPrefix);
+        overflow.push_back(std::move(task));
+    }
+
+    queued.fetch_add(1, std::memory_order_release);
+    queued.notify_one();
+}
+
+void CallbackPool::Worker()
+{
+    while (true)
+    {
+        // Claim a task first, so a worker only pops what is known to be there
+        int count = queued.load(std::memory_order_acquire);
+        if (count == 0)
+        {
+            queued.wait(0, std::memory_order_acquire);
+            continue;
+        }
+        if (!queued.compare_exchange_weak(count, count - 1, std::memory_order_acquire))
+            continue;
+
+        // A producer that reserved an earlier cell may still be filling it,
+        // or the task went to the overflow list
+        Task task;
+        while (!queue.TryPop(task) && !TakeOverflow(task))
+            std::this_thread::yield();
+
+        if (!task)
+            return;
+
+        try
+        {
+            task();
+        }
+        catch (const std::exception& e)
+        {
+            RPC_LOG_WARNING("%s Task threw: %s", logPrefix, e.what());
+        }
+    }
+}
+
+bool CallbackPool::TakeOverflow(Task& task)
+{
+    std::lock_guard<std::mutex> overflowLock(overflowMutex);
+    if (overflow.empty())
+        return false;
+    task = std::move(overflow.front());
+    overflow.pop_front();
+    return true;
+}
@@ -0,0 +1,82 @@
+#include "RpcTransport.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+void LoopbackPipe::Write(const void* data, size_t size)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (closed)
+            return;
+        buffer.append(static_cast<const char*>(data), size);
+    }
+    readable.notify_one();
+}
+
+bool LoopbackPipe::Read(void* data, size_t size)
+{
+    char* dataPtr = static_cast<char*>(data);
+    std::unique_lock<std::mutex> lock(mutex);
+    while (size > 0)
+    {
+        readable.wait(lock, [&]() { return closed || readOffset < buffer.size(); });
+        if (readOffset == buffer.size())
+            return false;
+
+        size_t chunk = std::min(size, buffer.size() - readOffset);
+        memcpy(dataPtr, buffer.data() + readOffset, chunk);
+        readOffset += chunk;
+        dataPtr += chunk;
+        size -= chunk;
+
+        if (readOffset == buffer.size())
+        {
+            buffer.clear();
+            readOffset = 0;
+        }
+    }
+    return true;
+}
+
+void LoopbackPipe::Close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+    }
+    readable.notify_all();
+}
+
+LoopbackTransport::LoopbackTransport():
+    toServer(std::make_shared<LoopbackPipe>()),
+    toClient(std::make_shared<LoopbackPipe>())
+{
+}
+
+void LoopbackTransport::Connect()
+{
+}
+
+void LoopbackTransport::Send(const TransportBuffer* buffers, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        toServer->Write(buffers[i].data, buffers[i].size);
+}
+
+bool LoopbackTransport::Recv(void* data, size_t size)
+{
+    return toClient->Read(data, size);
+}
+
+void LoopbackTransport::Wakeup()
+{
+    toServer->Close();
+    toClient->Close();
+}
+
+void LoopbackTransport::Close()
+{
+    Wakeup();
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+#define SOCKET_CHECK(status) if (status < 0)    \
+    {                                           \
+        perror("Failed: " #status "\n");        \
+        exit(EXIT_FAILURE);                     \
+    }
+
+#define STATUS_CHECK(status, msg) if (status)   \
+    {                                           \
+        perror("ERROR: " #msg "\n");            \
+        exit(EXIT_FAILURE);                     \
+    }
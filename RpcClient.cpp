@@ -1,109 +1,153 @@
 #include "RpcClient.h"
+#include "RpcCheck.h"
+#include "RpcLog.h"
 
-#ifdef _WIN32
 #include <algorithm>
-#else
-#include <netinet/in.h>
-#include <sys/socket.h>
-#include <unistd.h>
-#endif
-
 #include <iostream>
+#include <cstring>
 
-#define SOCKET_CHECK(status) if (status < 0)    \
-    {                                           \
-        perror("Failed: " #status "\n");        \
-        exit(EXIT_FAILURE);                     \
-    }
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
-#define STATUS_CHECK(status, msg) if (status)   \
-    {                                           \
-        perror("ERROR: " #msg "\n");            \
-        exit(EXIT_FAILURE);                     \
-    }
+// Below this, copying the payload through the socket beats setting up a memfd
+constexpr size_t FD_PAYLOAD_THRESHOLD = 256 * 1024;
 
-RpcClient::RpcClient(int port, bool isNode): isNode(isNode)
+#ifndef _WIN32
+// A memfd holding payload, sealed so the server can map it without the
+// size or contents changing under it; -1 if that fails
+static int CreatePayloadFd(const std::string& payload)
 {
-#ifdef _WIN32
-    WSADATA wsaData;
-    int iResult = WSAStartup(MAKEWORD(2,2), &wsaData);
-    if (iResult != 0) {
-        throw std::runtime_error("WSAStartup failed.\n");
-    }
-    clientSocket = socket(AF_INET, SOCK_STREAM, 0);
-    if (clientSocket == INVALID_SOCKET) {
-        WSACleanup();
-        throw std::runtime_error("Error at socket creation.\n");
-    }
+    int fd = memfd_create("rpc-payload", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+        return -1;
 
-    sockaddr_in serverAddr;
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(port);
-    serverAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    size_t written = 0;
+    while (written < payload.size())
+    {
+        ssize_t count = write(fd, payload.data() + written, payload.size() - written);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+        {
+            close(fd);
+            return -1;
+        }
+        written += count;
+    }
 
-    if (connect(clientSocket, (SOCKADDR*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
-        throw std::runtime_error("Socket connection failed.\n");
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0)
+    {
+        close(fd);
+        return -1;
     }
-#else
-    sockaddr_in address = {};
-    address.sin_family = AF_INET;
-    address.sin_port = htons(port);
-    address.sin_addr.s_addr = INADDR_ANY;
-
-    SOCKET_CHECK((clientSocket = socket(AF_INET, SOCK_STREAM, 0)) < 0);
-    SOCKET_CHECK((connect(clientSocket, (struct sockaddr*)&address, sizeof(address))) < 0);
+    return fd;
+}
 #endif
 
-    size_t sizeRecv = recv(clientSocket, (char*)&responseHeader, sizeof(ResponseHeader), 0);
+RpcClient::RpcClient(std::unique_ptr<ITransport> backend, bool isNode):
+    transport(std::move(backend)), isNode(isNode), wireFormat(WireFormat::JSON), batchSupported(false), fdPayloads(false), blobPayloads(false), compactHeaders(false),
+    callbackPool("[RPC Client]")
+{
+    transport->Connect();
+
+    ResponseHeader helloHeader;
+    std::string helloArgs;
+    bool received = transport->ReceiveFrame(helloHeader, helloArgs);
     STATUS_CHECK(
-        sizeRecv != sizeof(ResponseHeader) || responseHeader.bufferSize != 0, 
+        !received || helloHeader.bufferSize != 0, 
         "DEBUG: Error receiving client ID."
     );
 
-    rpcReturnValueReady.store(false);
+    nextRequestId.store(1);
+    nextCallbackId.store(1);
+    spinLimit.store(4096);
+    spinBudget.store(0);
     running.store(true);
-    clientId = responseHeader.clientId;
-    printf("Client ID: %d\n", clientId);
+    clientId = helloHeader.clientId;
+    RPC_LOG_DEBUG("[RPC Client] Client ID: %d", clientId);
 
-    receiver = std::thread([&]()
+    callbackPool.Start(2);
+
+    receiver = std::thread([this]()
     {
+        ResponseHeader responseHeader;
+        std::string responseArgsJson;
+
         while (running)
         {
-            while (rpcReturnValueReady == true)
-                continue;
-
-            size_t sizeRecv = recv(clientSocket, (char*)&responseHeader, sizeof(ResponseHeader), MSG_WAITALL);
-            STATUS_CHECK(sizeRecv != sizeof(ResponseHeader) && running, "DEBUG: failed to recv callback header");
+            bool received = transport->ReceiveFrame(responseHeader, responseArgsJson);
+            STATUS_CHECK(!received && running, "DEBUG: failed to recv callback header");
             
             if (!running)
                 return;
-        
-            if (responseHeader.bufferSize != 0)
-            {
-                responseArgsJson.resize(responseHeader.bufferSize);
-            
-                int bytesReceived = 0;
-                while (bytesReceived < responseHeader.bufferSize)
-                {
-                    int chunkSize = std::min<int>(1024, responseHeader.bufferSize - bytesReceived);
-                    char* dataPtr = responseArgsJson.data() + bytesReceived;
-                    int chunkBytesReceived = recv(clientSocket, dataPtr, chunkSize, 0);
-        
-                    STATUS_CHECK(chunkBytesReceived == -1, "Error receiving message data");
-                    bytesReceived += chunkBytesReceived;
-                }
-            }
 
             if (responseHeader.msgType == ResponseHeader::MsgType::MSG_CALLBACK)
             {
-                if (isNode)
-                    std::thread(callbackHandler, responseHeader.clientId, responseArgsJson).detach();
+                if (this->isNode)
+                {
+                    callbackPool.Post([this, id = responseHeader.clientId, args = std::move(responseArgsJson)]()
+                    {
+                        callbackHandler(id, args);
+                    });
+                }
                 else
-                    std::thread(ProcessCallback, callbackRegistry, responseHeader, responseArgsJson).detach();
+                {
+                    callbackPool.Post([this, header = responseHeader, args = std::move(responseArgsJson)]()
+                    {
+                        ProcessCallback(header, args);
+                    });
+                }
             }
             else if (responseHeader.msgType == ResponseHeader::MsgType::MSG_RETURN)
-            {                
-                rpcReturnValueReady = true;
+            {
+                std::shared_ptr<PendingCall> call;
+                {
+                    std::lock_guard<std::mutex> pendingLock(pendingMutex);
+                    auto it = pendingCalls.find(responseHeader.requestId);
+                    if (it != pendingCalls.end())
+                    {
+                        call = std::move(it->second);
+                        pendingCalls.erase(it);
+                    }
+                }
+
+                if (!call && responseHeader.requestId == 0)
+                    continue;  // A server ignoring RPC_FLAG_ONEWAY answered a Notify
+
+                if (!call)
+                {
+                    RPC_LOG_WARNING("[RPC Client] Unmatched response for request %d", responseHeader.requestId);
+                    continue;
+                }
+
+                stats.RecordReturn(
+                    *call->function,
+                    std::chrono::steady_clock::now() - call->sent,
+                    sizeof(responseHeader) + responseHeader.bufferSize,
+                    responseHeader.u.statusCode != 0
+                );
+
+                call->responseHeader = responseHeader;
+                call->responsePayload.swap(responseArgsJson);
+
+                if (!call->resolving.empty() && responseHeader.methodId != 0)
+                {
+                    std::unique_lock<std::shared_mutex> methodLock(methodMutex);
+                    methodIds[call->resolving] = responseHeader.methodId;
+                }
+
+                if (call->onReturn)
+                {
+                    call->onReturn(*call);
+                }
+                else
+                {
+                    call->ready.store(true);
+                    call->ready.notify_one();
+                }
             }
             else
             {
@@ -111,18 +155,21 @@ RpcClient::RpcClient(int port, bool isNode): isNode(isNode)
             }
         }
     });
+
+    // Node passes its own JSON arguments through, so it stays on JSON
+    if (isNode)
+        Handshake({});
+    else
+        Handshake({ WireFormat::MessagePack, WireFormat::CBOR, WireFormat::NativeJSON });
 }
 
 RpcClient::~RpcClient()
 {
     running.store(false);
-#ifdef _WIN32
-    closesocket(clientSocket);
-    WSACleanup();
-#else
-    close(clientSocket);
-#endif
+    transport->Wakeup();  // Fails the receiver's pending ReceiveFrame
     receiver.join();
+    callbackPool.Stop();
+    transport->Close();
 }
 
 nlohmann::json RpcClient::Call(
@@ -130,50 +177,189 @@ nlohmann::json RpcClient::Call(
     const std::vector<std::pair<std::string, nlohmann::json>>& dataArgs,
     const std::vector<std::pair<std::string, Callback>>& callbackArgs)
 {
-    std::vector<std::string> keys;
-    std::vector<std::string> values;
+    WireFormat format = wireFormat;
+    RpcRequest rpcRequest = MakeCall(functionName, format, dataArgs, callbackArgs);
+    return ProcessRPC(rpcRequest);
+}
 
-    for (const auto& [k, v] : dataArgs) {
-        keys.push_back(k);
-        values.push_back(v.dump());  // Convert json to string
+std::string RpcClient::Call(const std::string& functionName, const std::string& jsonArgs)
+{
+    RpcRequest rpcRequest = MakeRequest(functionName, jsonArgs);
+    return ProcessRPC(rpcRequest);
+}
+
+void RpcClient::Notify(
+    const std::string& functionName,
+    const std::vector<std::pair<std::string, nlohmann::json>>& dataArgs,
+    const std::vector<std::pair<std::string, Callback>>& callbackArgs)
+{
+    WireFormat format = wireFormat;
+    RpcRequest rpcRequest = MakeCall(functionName, format, dataArgs, callbackArgs);
+    SendRPC(rpcRequest, nullptr);
+}
+
+std::vector<RpcClient::BatchResult> RpcClient::CallBatch(std::span<const BatchEntry> entries)
+{
+    WireFormat format = wireFormat;
+    if (format == WireFormat::JSON || !batchSupported)
+        return PipelineBatch(entries, format);
+
+    // {"calls":[{"function":...,"args":{...},"callbacks":[...]}]}, with the
+    // blobs of all entries in one section
+    BlobSection blobs;
+    std::vector<int64_t> callbackIds;
+    nlohmann::json calls = nlohmann::json::array();
+    for (const BatchEntry& entry : entries)
+    {
+        nlohmann::json call = ArgsDocument(entry.dataArgs, entry.callbackArgs, blobPayloads ? &blobs : nullptr);
+        call["function"] = entry.functionName;
+        if (call.contains("callbacks"))
+            callbackIds.insert(callbackIds.end(), call["callbacks"].begin(), call["callbacks"].end());
+        calls.push_back(std::move(call));
     }
 
-    for (const auto& [k, cb] : callbackArgs) {
-        int id = RegisterCallback(cb);
-        keys.push_back(k);
-        values.push_back(std::to_string(id));
+    nlohmann::json document;
+    document["calls"] = std::move(calls);
+    RpcRequest req = blobs.used
+        ? MakeRequest("_RPC::Batch", blobs.Finish(EncodePayload(format, document)), format, RPC_FLAG_BLOBS)
+        : MakeRequest("_RPC::Batch", EncodePayload(format, document), format);
+
+    auto call = std::make_shared<PendingCall>();
+    SendRPC(req, call);
+    WaitForReturn(*call);
+
+    // The whole batch fails when the server rejects it before running any
+    // entry, so their callbacks will never fire
+    if (call->responseHeader.u.statusCode != 0)
+    {
+        UnregisterCallbacks(callbackIds);
+        return std::vector<BatchResult>(entries.size(), BatchResult{ 1, DecodeReturn(req, *call) });
     }
 
-    nlohmann::json args;
-    args["keys"] = keys;
-    args["values"] = values;
+    // {"result":[{"status":0,"result":...}]}, an entry for each call
+    nlohmann::json response = DecodePayload(GetWireFormat(call->responseHeader.flags), call->responsePayload);
+    auto returned = response.find("result");
+    if (returned == response.end() || !returned->is_array() || returned->size() != entries.size())
+        throw std::runtime_error("[RPC Client] Batch result does not match its calls.");
 
-    RpcRequest rpcRequest;
-    rpcRequest.header.clientId = clientId;
-    strncpy(
-        rpcRequest.header.functionName,
-        functionName.c_str(),
-        sizeof(rpcRequest.header.functionName) - 1
-    );
-    rpcRequest.jsonArgs = args.dump();
-    rpcRequest.header.bufferSize = rpcRequest.jsonArgs.size();
+    std::vector<BatchResult> results;
+    results.reserve(entries.size());
+    for (const nlohmann::json& entry : *returned)
+    {
+        if (!entry.is_object())
+            throw std::runtime_error("[RPC Client] Batch result does not match its calls.");
+        results.push_back({ entry.value("status", 1), entry.value("result", nlohmann::json()) });
+    }
+    return results;
+}
 
-    return ProcessRPC(rpcRequest);
+std::vector<RpcClient::BatchResult> RpcClient::PipelineBatch(std::span<const BatchEntry> entries, WireFormat format)
+{
+    // Everything goes out before the first wait, so this still costs a
+    // single round trip of latency
+    std::vector<RpcRequest> requests;
+    std::vector<std::shared_ptr<PendingCall>> calls;
+    requests.reserve(entries.size());
+    calls.reserve(entries.size());
+    for (const BatchEntry& entry : entries)
+    {
+        requests.push_back(MakeCall(entry.functionName, format, entry.dataArgs, entry.callbackArgs));
+        calls.push_back(std::make_shared<PendingCall>());
+        SendRPC(requests.back(), calls.back());
+    }
+
+    std::vector<BatchResult> results;
+    results.reserve(entries.size());
+    for (size_t i = 0; i < calls.size(); ++i)
+    {
+        WaitForReturn(*calls[i]);
+        results.push_back({ calls[i]->responseHeader.u.statusCode, DecodeReturn(requests[i], *calls[i]) });
+    }
+    return results;
 }
 
-std::string RpcClient::Call(const std::string& functionName, const std::string& jsonArgs)
+std::future<nlohmann::json> RpcClient::CallAsync(
+    const std::string& functionName,
+    const std::vector<std::pair<std::string, nlohmann::json>>& dataArgs,
+    const std::vector<std::pair<std::string, Callback>>& callbackArgs)
 {
-    RpcRequest rpcRequest;
-    rpcRequest.header.clientId = clientId;
-    strncpy(
-        rpcRequest.header.functionName,
-        functionName.c_str(),
-        sizeof(rpcRequest.header.functionName) - 1
-    );
-    rpcRequest.jsonArgs = jsonArgs;
-    rpcRequest.header.bufferSize = rpcRequest.jsonArgs.size();
+    WireFormat format = wireFormat;
+    RpcRequest rpcRequest = MakeCall(functionName, format, dataArgs, callbackArgs);
 
-    return ProcessRPC(rpcRequest);
+    auto promise = std::make_shared<std::promise<nlohmann::json>>();
+    std::future<nlohmann::json> future = promise->get_future();
+
+    // Runs on the receiver thread when the MSG_RETURN arrives
+    auto call = std::make_shared<PendingCall>();
+    call->onReturn = [this, promise, rpcRequest](PendingCall& returned)
+    {
+        try
+        {
+            promise->set_value(DecodeReturn(rpcRequest, returned));
+        }
+        catch (...)
+        {
+            promise->set_exception(std::current_exception());
+        }
+    };
+
+    SendRPC(rpcRequest, std::move(call));
+    return future;
+}
+
+RpcClient::CallAwaiter RpcClient::CallCo(
+    const std::string& functionName,
+    const std::vector<std::pair<std::string, nlohmann::json>>& dataArgs,
+    const std::vector<std::pair<std::string, Callback>>& callbackArgs)
+{
+    WireFormat format = wireFormat;
+    return CallAwaiter(*this, MakeCall(functionName, format, dataArgs, callbackArgs));
+}
+
+RpcClient::CallAwaiter::CallAwaiter(RpcClient& client, RpcRequest request):
+    client(client), request(std::move(request))
+{
+}
+
+void RpcClient::CallAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    auto call = std::make_shared<PendingCall>();
+    call->onReturn = [this, handle](PendingCall& returned)
+    {
+        try
+        {
+            result = client.DecodeReturn(request, returned);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        client.Resume(handle);
+    };
+
+    // The coroutine may resume (and destroy this awaiter) as soon as the
+    // request is on the wire; nothing here may touch members after SendRPC.
+    client.SendRPC(request, std::move(call));
+}
+
+nlohmann::json RpcClient::CallAwaiter::await_resume()
+{
+    if (error)
+        std::rethrow_exception(error);
+    return std::move(result);
+}
+
+void RpcClient::SetResumeExecutor(Executor executor)
+{
+    resumeExecutor = std::move(executor);
+}
+
+void RpcClient::Resume(std::coroutine_handle<> handle)
+{
+    if (resumeExecutor)
+        resumeExecutor([handle]() { handle.resume(); });
+    else
+        handle.resume();
 }
 
 void RpcClient::RegisterCallbackHandler(std::function<void(int, const std::string&)> fn)
@@ -181,22 +367,61 @@ void RpcClient::RegisterCallbackHandler(std::function<void(int, const std::strin
     callbackHandler = fn;
 }
 
-int RpcClient::RegisterCallback(Callback cb)
+void RpcClient::SetCallbackThreads(int count)
 {
-    int id = Call("_RPC::AllocateCallback", {{"clientId", clientId}});
+    callbackPool.Stop();
+    callbackPool.Start(count);
+}
+
+std::vector<FunctionStats> RpcClient::GetStats()
+{
+    return stats.Snapshot();
+}
+
+void RpcClient::SetSpinLimit(int iterations)
+{
+    spinLimit.store(std::max(iterations, 0));
+    spinBudget.store(std::min(spinBudget.load(), spinLimit.load()));
+}
+
+int64_t RpcClient::RegisterCallback(Callback cb)
+{
+    int64_t id = (int64_t(clientId) << 32) | nextCallbackId++;
+    std::unique_lock<std::shared_mutex> registryLock(callbackMutex);
     callbackRegistry[id] = std::move(cb);
     return id;
 }
 
-void RpcClient::ProcessCallback(
-    const std::unordered_map<int, Callback>& cbRegistry,
-    const ResponseHeader& respHeader,
-    const std::string& respArgsJson)
+void RpcClient::UnregisterCallbacks(const std::vector<int64_t>& ids)
 {
-    auto it = cbRegistry.find(respHeader.u.callbackId);
+    std::unique_lock<std::shared_mutex> registryLock(callbackMutex);
+    for (int64_t id : ids)
+        callbackRegistry.erase(id);
+}
+
+void RpcClient::ProcessCallback(const ResponseHeader& respHeader, const std::string& respArgsJson)
+{
+    // Copy out the one entry, so the callback runs without holding the lock
+    Callback callback;
+    {
+        std::shared_lock<std::shared_mutex> registryLock(callbackMutex);
+        int64_t id = (int64_t(respHeader.clientId) << 32) | uint32_t(respHeader.u.callbackId);
+        auto it = callbackRegistry.find(id);
+        if (it != callbackRegistry.end())
+            callback = it->second;
+    }
+
+    WireFormat format = GetWireFormat(respHeader.flags);
+    if (format != WireFormat::JSON)
+    {
+        nlohmann::json args = DecodePayload(format, respArgsJson);
+        if (callback && args.is_object())
+            callback(args);
+        return;
+    }
 
     nlohmann::json wrapped = nlohmann::json::parse(respArgsJson, nullptr, false);
-    if (it != cbRegistry.end() && !wrapped.is_discarded() && 
+    if (callback && !wrapped.is_discarded() && 
         wrapped.contains("keys") && wrapped.contains("values"))
     {
         nlohmann::json flat;
@@ -216,50 +441,337 @@ void RpcClient::ProcessCallback(
             }
         }
 
-        it->second(flat); // Invoke callback with reconstructed flat object
+        callback(flat); // Invoke callback with reconstructed flat object
     }
 }
 
-nlohmann::json RpcClient::ProcessRPC(const RpcRequest& req)
+void RpcClient::WaitForReturn(PendingCall& call)
 {
+    // Spin for a budget that grows while replies keep landing inside it and
+    // shrinks when they don't, then park on the flag until the receiver
+    // notifies. Fast servers get spin latency, slow ones cost no CPU.
+    int budget = spinBudget.load(std::memory_order_relaxed);
+    for (int i = 0; i < budget; ++i)
     {
-        std::lock_guard<std::mutex> RpcLock(callMutex);
-        
-        size_t sizeSent = send(clientSocket, (char*)&req, sizeof(req.header), 0);
-        STATUS_CHECK(sizeSent != sizeof(req.header), "DEBUG: failed to send header");
-
-        if (req.header.bufferSize != 0)
+        if (call.ready.load(std::memory_order_acquire))
         {
-            int index = 0;
-            while (index < req.header.bufferSize)
-            {
-                int chunk_size = std::min<int>(1024, req.header.bufferSize - index);
-                const char* data_ptr = req.jsonArgs.c_str() + index;
-                int bytes_sent = send(clientSocket, data_ptr, chunk_size, 0);
-
-                STATUS_CHECK(bytes_sent == -1, "DEBUG: failed to send everything");
-                index += bytes_sent;
-            }
+            spinBudget.store(
+                std::min(budget * 2, spinLimit.load(std::memory_order_relaxed)),
+                std::memory_order_relaxed
+            );
+            return;
         }
     }
-    
-    while (rpcReturnValueReady == false)
-        continue;
 
-    printf("RPC: %s |-> %s\n", req.header.functionName, responseArgsJson.c_str());
+    spinBudget.store(
+        std::max(budget / 2, std::min(64, spinLimit.load(std::memory_order_relaxed))),
+        std::memory_order_relaxed
+    );
+    call.ready.wait(false, std::memory_order_acquire);
+}
+
+std::string RpcClient::EncodeArgs(
+    WireFormat format,
+    const std::vector<std::pair<std::string, nlohmann::json>>& dataArgs,
+    const std::vector<std::pair<std::string, Callback>>& callbackArgs,
+    uint8_t* flags)
+{
+    if (format != WireFormat::JSON)
+    {
+        BlobSection blobs;
+        nlohmann::json document = ArgsDocument(dataArgs, callbackArgs, flags && blobPayloads ? &blobs : nullptr);
+        if (!blobs.used)
+            return EncodePayload(format, document);
+
+        *flags |= RPC_FLAG_BLOBS;
+        return blobs.Finish(EncodePayload(format, document));
+    }
+
+    std::vector<std::string> keys;
+    std::vector<std::string> values;
+
+    for (const auto& [k, v] : dataArgs) {
+        keys.push_back(k);
+        values.push_back(IsBlob(v) ? BlobToArray(ResolveBlob(v, {})).dump() : v.dump());  // Convert json to string
+    }
+
+    std::vector<int64_t> callbacks;
+    for (const auto& [k, cb] : callbackArgs) {
+        int64_t id = RegisterCallback(cb);
+        keys.push_back(k);
+        values.push_back(std::to_string(id));
+        callbacks.push_back(id);
+    }
+
+    nlohmann::json args;
+    args["keys"] = keys;
+    args["values"] = values;
+
+    // Tells the server which clients the new callback IDs belong to
+    if (!callbacks.empty())
+        args["callbacks"] = callbacks;
+    return args.dump();
+}
+
+nlohmann::json RpcClient::ArgsDocument(
+    const std::vector<std::pair<std::string, nlohmann::json>>& dataArgs,
+    const std::vector<std::pair<std::string, Callback>>& callbackArgs,
+    BlobSection* blobs)
+{
+    // Values travel as themselves instead of as dumped strings
+    nlohmann::json args = nlohmann::json::object();
+    for (const auto& [k, v] : dataArgs)
+    {
+        if (!IsBlob(v))
+            args[k] = v;
+        else if (blobs)
+            args[k] = blobs->Append(v);
+        else
+            args[k] = BlobToArray(ResolveBlob(v, {}));
+    }
+
+    std::vector<int64_t> callbacks;
+    for (const auto& [k, cb] : callbackArgs) {
+        int64_t id = RegisterCallback(cb);
+        args[k] = id;
+        callbacks.push_back(id);
+    }
+
+    nlohmann::json document;
+    document["args"] = std::move(args);
+    if (!callbacks.empty())
+        document["callbacks"] = callbacks;
+    return document;
+}
+
+RpcRequest RpcClient::MakeRequest(const std::string& functionName, std::string jsonArgs, WireFormat format, uint8_t flags)
+{
+    RpcRequest rpcRequest{};
+    rpcRequest.header.clientId = clientId;
+    rpcRequest.header.flags = uint8_t(format) | flags;
+    strncpy(
+        rpcRequest.header.functionName,
+        functionName.c_str(),
+        sizeof(rpcRequest.header.functionName) - 1
+    );
+    rpcRequest.jsonArgs = std::move(jsonArgs);
+    rpcRequest.header.bufferSize = rpcRequest.jsonArgs.size();
+    return rpcRequest;
+}
+
+RpcRequest RpcClient::MakeCall(
+    const std::string& functionName,
+    WireFormat format,
+    const std::vector<std::pair<std::string, nlohmann::json>>& dataArgs,
+    const std::vector<std::pair<std::string, Callback>>& callbackArgs)
+{
+    uint8_t flags = 0;
+    std::string payload = EncodeArgs(format, dataArgs, callbackArgs, &flags);
+    return MakeRequest(functionName, std::move(payload), format, flags);
+}
+
+void RpcClient::SendRPC(RpcRequest& req, std::shared_ptr<PendingCall> call)
+{
+    uint16_t methodId = 0;
+    if (compactHeaders)
+    {
+        std::shared_lock<std::shared_mutex> methodLock(methodMutex);
+        auto it = methodIds.find(req.header.functionName);
+        if (it != methodIds.end())
+            methodId = it->second;
+    }
+
+    // A one-way call by name still takes its reply, to learn the method ID;
+    // nobody waits for it
+    if (!call && compactHeaders && methodId == 0)
+    {
+        call = std::make_shared<PendingCall>();
+        call->onReturn = [](PendingCall&) {};
+    }
+
+    uint64_t frameSize = compactHeaders
+        ? sizeof(CompactRequestHeader) + (methodId == 0 ? strlen(req.header.functionName) : 0)
+        : sizeof(req.header);
+    const std::string& function = stats.RecordSend(req.header.functionName, frameSize + req.jsonArgs.size());
+
+    if (call)
+    {
+        call->function = &function;
+        call->sent = std::chrono::steady_clock::now();
+        req.header.requestId = nextRequestId++;
+        req.header.flags &= ~RPC_FLAG_ONEWAY;
+        if (compactHeaders && methodId == 0)
+            call->resolving = req.header.functionName;
+
+        // Register before sending so the receiver can never see an unknown ID
+        std::lock_guard<std::mutex> pendingLock(pendingMutex);
+        pendingCalls[req.header.requestId] = std::move(call);
+    }
+    else
+    {
+        req.header.requestId = 0;
+        req.header.flags |= RPC_FLAG_ONEWAY;
+    }
+
+    // Large payloads are handed over as a memfd the server maps; the frame
+    // itself carries none of it
+    int payloadFd = -1;
+#ifndef _WIN32
+    if (fdPayloads && req.jsonArgs.size() >= FD_PAYLOAD_THRESHOLD)
+        payloadFd = CreatePayloadFd(req.jsonArgs);
+#endif
+    if (payloadFd >= 0)
+    {
+        req.header.flags |= RPC_FLAG_MEMFD;
+        req.header.bufferSize = 0;
+    }
+    size_t payloadSize = payloadFd >= 0 ? 0 : req.jsonArgs.size();
+
+    CompactRequestHeader compact{};
+    compact.requestId = req.header.requestId;
+    compact.methodId = methodId;
+    compact.flags = req.header.flags;
+    compact.nameLength = methodId == 0 ? uint8_t(strlen(req.header.functionName)) : 0;
+    compact.bufferSize = req.header.bufferSize;
+
+    TransportBuffer buffers[] = {
+        { &req.header, sizeof(req.header) },
+        { req.jsonArgs.data(), payloadSize }
+    };
+    TransportBuffer compactBuffers[] = {
+        { &compact, sizeof(compact) },
+        { req.header.functionName, compact.nameLength },
+        { req.jsonArgs.data(), payloadSize }
+    };
+
+    std::lock_guard<std::mutex> RpcLock(callMutex);
+    if (payloadFd >= 0)
+    {
+        // The message in flight holds its own reference to the memfd
+        if (compactHeaders)
+            transport->SendWithFd(compactBuffers, 3, payloadFd);
+        else
+            transport->SendWithFd(buffers, 2, payloadFd);
+#ifndef _WIN32
+        close(payloadFd);
+#endif
+    }
+    else if (compactHeaders)
+    {
+        transport->Send(compactBuffers, 3);
+    }
+    else
+    {
+        transport->Send(buffers, 2);
+    }
+}
+
+nlohmann::json RpcClient::DecodeReturn(const RpcRequest& req, const PendingCall& call)
+{
+    const std::string& responseArgsJson = call.responsePayload;
+
+    WireFormat format = GetWireFormat(call.responseHeader.flags);
+    if (format != WireFormat::JSON)
+    {
+        // The result is already typed; no second parse
+        nlohmann::json response = DecodePayload(format, responseArgsJson);
+        RPC_LOG_TRACE("RPC: %s |-> %s", req.header.functionName, response.dump().c_str());
+        return response["result"];
+    }
+
+    RPC_LOG_TRACE("RPC: %s |-> %s", req.header.functionName, responseArgsJson.c_str());
 
     if (isNode) 
     {
         auto str = nlohmann::json::parse(responseArgsJson)["result"].get<std::string>();
-        rpcReturnValueReady = false;
         return str;
     }
     auto str = nlohmann::json::parse(responseArgsJson)["result"].get<std::string>();
     auto retval = nlohmann::json::parse(str, nullptr, false);
-    rpcReturnValueReady = false;
 
     if (retval.is_discarded()) {
         return str;
     }
     return retval;
 }
+
+nlohmann::json RpcClient::ProcessRPC(RpcRequest& req)
+{
+    auto call = std::make_shared<PendingCall>();
+    SendRPC(req, call);
+    WaitForReturn(*call);
+    return DecodeReturn(req, *call);
+}
+
+void RpcClient::Handshake(const std::vector<WireFormat>& preferred)
+{
+    nlohmann::json features = nlohmann::json::array({ RPC_FEATURE_COMPACT_HEADERS, RPC_FEATURE_BATCH });
+    if (transport->CanSendFds())
+        features.push_back(RPC_FEATURE_MEMFD);
+    if (!isNode)
+        features.push_back(RPC_FEATURE_BLOBS);
+
+    // The server switches to compact headers as soon as it reads this
+    // request, and nothing else may be sent until we know whether it did.
+    // Servers that predate features answer with the format's name alone,
+    // and ones without _RPC::Negotiate fail the call; neither grants any.
+    nlohmann::json reply = Negotiate(preferred, features);
+    if (reply.is_string())
+    {
+        // Node gets the raw string
+        nlohmann::json parsed = nlohmann::json::parse(reply.get<std::string>(), nullptr, false);
+        if (parsed.is_object())
+            reply = std::move(parsed);
+    }
+
+    nlohmann::json granted = reply.is_object() ? reply.value("features", nlohmann::json::array()) : nlohmann::json::array();
+    auto isGranted = [&](const char* feature)
+    {
+        return granted.is_array() && std::find(granted.begin(), granted.end(), feature) != granted.end();
+    };
+
+    wireFormat = ChosenFormat(preferred, reply.is_object() ? reply.value("format", nlohmann::json()) : reply);
+    compactHeaders = isGranted(RPC_FEATURE_COMPACT_HEADERS);
+    batchSupported = isGranted(RPC_FEATURE_BATCH);
+    fdPayloads = isGranted(RPC_FEATURE_MEMFD);
+    blobPayloads = isGranted(RPC_FEATURE_BLOBS);
+}
+
+WireFormat RpcClient::Negotiate(const std::vector<WireFormat>& preferred)
+{
+    WireFormat chosen = ChosenFormat(preferred, Negotiate(preferred, nullptr));
+    wireFormat = chosen;
+    return chosen;
+}
+
+nlohmann::json RpcClient::Negotiate(const std::vector<WireFormat>& preferred, const nlohmann::json& features)
+{
+    nlohmann::json formats = nlohmann::json::array();
+    for (WireFormat format : preferred)
+        formats.push_back(WireFormatName(format));
+
+    std::vector<std::pair<std::string, nlohmann::json>> args = {{"formats", formats}};
+    if (!features.is_null())
+        args.emplace_back("features", features);
+
+    // Always asked in JSON, which every server reads
+    RpcRequest req = MakeRequest("_RPC::Negotiate", EncodeArgs(WireFormat::JSON, args, {}));
+    auto call = std::make_shared<PendingCall>();
+    SendRPC(req, call);
+    WaitForReturn(*call);
+
+    // Servers without _RPC::Negotiate fail the call
+    if (call->responseHeader.u.statusCode != 0)
+        return nullptr;
+    return DecodeReturn(req, *call);
+}
+
+WireFormat RpcClient::ChosenFormat(const std::vector<WireFormat>& preferred, const nlohmann::json& name)
+{
+    for (WireFormat format : preferred)
+    {
+        if (name == WireFormatName(format))
+            return format;
+    }
+    return WireFormat::JSON;
+}
@@ -0,0 +1,141 @@
+#include "RpcLog.h"
+#include "MpmcQueue.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+std::atomic<LogLevel> RpcLog::threshold{LogLevel::Info};
+
+namespace
+{
+    struct LogLine
+    {
+        LogLevel level;
+        std::string text;
+    };
+
+    std::mutex sinkMutex;
+    RpcLog::Sink sink;
+
+    void Emit(LogLevel level, const std::string& text)
+    {
+        std::lock_guard<std::mutex> sinkLock(sinkMutex);
+        if (sink)
+        {
+            sink(level, text);
+        }
+        else
+        {
+            // Sinks get the level on its own; messages don't repeat it
+            if (level == LogLevel::Warning)
+                fputs("WARNING: ", stdout);
+            else if (level == LogLevel::Error)
+                fputs("ERROR: ", stdout);
+            fputs(text.c_str(), stdout);
+            fputc('\n', stdout);
+        }
+    }
+
+    // Background writer behind SetAsync. Lives until exit, and drains what
+    // is left when the process ends.
+    class AsyncWriter
+    {
+    public:
+        AsyncWriter(): queue(4096), running(true)
+        {
+            queued.store(0);
+            writer = std::thread(&AsyncWriter::Run, this);
+        }
+
+        ~AsyncWriter()
+        {
+            running.store(false);
+            queued.fetch_add(1);
+            queued.notify_one();
+            writer.join();
+        }
+
+        void Push(LogLevel level, std::string text)
+        {
+            LogLine line{ level, std::move(text) };
+            if (!queue.TryPush(line))
+                return;
+            queued.fetch_add(1, std::memory_order_release);
+            queued.notify_one();
+        }
+
+    private:
+        void Run()
+        {
+            LogLine line;
+            while (true)
+            {
+                while (queue.TryPop(line))
+                    Emit(line.level, line.text);
+
+                int observed = queued.load(std::memory_order_acquire);
+                if (!running.load())
+                    break;
+                if (queue.TryPop(line))
+                {
+                    Emit(line.level, line.text);
+                    continue;
+                }
+                queued.wait(observed, std::memory_order_acquire);
+            }
+
+            while (queue.TryPop(line))
+                Emit(line.level, line.text);
+            fflush(stdout);
+        }
+
+        MpmcQueue<LogLine> queue;
+        std::atomic_int queued;
+        std::atomic_bool running;
+        std::thread writer;
+    };
+
+    std::atomic_bool async{false};
+
+    AsyncWriter& Writer()
+    {
+        static AsyncWriter writer;
+        return writer;
+    }
+}
+
+void RpcLog::SetSink(Sink newSink)
+{
+    std::lock_guard<std::mutex> sinkLock(sinkMutex);
+    sink = std::move(newSink);
+}
+
+void RpcLog::SetAsync(bool enable)
+{
+    if (enable)
+        Writer();
+    async.store(enable);
+}
+
+void RpcLog::Write(LogLevel level, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    va_list copy;
+    va_copy(copy, args);
+    int size = vsnprintf(nullptr, 0, format, copy);
+    va_end(copy);
+
+    std::string text(size > 0 ? size : 0, '\0');
+    if (size > 0)
+        vsnprintf(text.data(), text.size() + 1, format, args);
+    va_end(args);
+
+    if (async.load(std::memory_order_relaxed))
+        Writer().Push(level, std::move(text));
+    else
+        Emit(level, text);
+}
@@ -0,0 +1,1209 @@
+#ifndef _WIN32
+
+#include "RpcServer.h"
+#include "RpcCodec.h"
+#include "RpcCheck.h"
+#include "RpcLog.h"
+#include "RpcTransport.h"
+#include "ShmRing.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Runs a list of calls back to back; handled by Dispatch itself
+constexpr uint16_t BATCH_METHOD_ID = 1;
+
+// Anything larger is taken for a corrupt header
+constexpr int MAX_REQUEST_SIZE = 1 << 30;
+
+constexpr size_t READ_CHUNK_SIZE = 64 * 1024;
+
+// Reads per wakeup before a connection yields to the others
+constexpr int READS_PER_TURN = 16;
+
+// Requests a worker handles for one connection before taking others' turns
+constexpr int REQUESTS_PER_TURN = 64;
+
+// A client that lets this much output pile up is dropped
+constexpr size_t MAX_OUTPUT_SIZE = 64 << 20;
+
+// Most descriptors taken from a single read
+constexpr size_t MAX_RECEIVED_FDS = 16;
+
+// ShmTransport names its segments this way; nothing else is opened
+constexpr const char* SHM_NAME_PREFIX = "/SharedMemRPC.";
+
+struct RpcServer::Request
+{
+    int requestId;
+    uint8_t flags;
+    uint16_t methodId;
+    uint16_t resolvedId;    // Sent back for unresolved compact requests
+    std::string name;
+    std::string payload;
+    bool viaRing = false;   // Answered through the shared-memory ring
+
+    // Replaces payload for RPC_FLAG_MEMFD requests; unmapped with the last copy
+    std::shared_ptr<const char> mapping;
+    size_t mappingSize = 0;
+};
+
+struct RpcServer::Connection
+{
+    int fd;
+    int clientId;
+    bool local;     // AF_UNIX, so it can pass file descriptors
+
+    // What callbacks are encoded in; set by _RPC::Negotiate
+    std::atomic<WireFormat> format{WireFormat::JSON};
+
+    // Read side, only touched by the event loop. Bytes in [inputStart,
+    // inputEnd) are received but not yet parsed.
+    bool compact = false;
+    bool backlogged = false;
+    std::vector<char> input;
+    size_t inputStart = 0;
+    size_t inputEnd = 0;
+
+    // Descriptors received ahead of the RPC_FLAG_MEMFD requests they belong to
+    std::deque<int> fds;
+
+    // Requests waiting for the one running; at most one worker drains them
+    std::mutex requestMutex;
+    std::deque<Request> requests;
+    bool draining = false;
+
+    // Write side. Bytes in [outputStart, output.size()) are frames the
+    // socket didn't take yet; they go out before anything new.
+    std::mutex writeMutex;
+    std::string output;
+    size_t outputStart = 0;
+
+    // Set by _RPC::AttachSharedMemory. From then on requests are read from
+    // the segment by ringThread, and replies and callbacks go back through
+    // it; the socket only tells when the client is gone. ringThread is
+    // guarded by writeMutex, ring writes by ringMutex.
+    std::atomic_bool closed{false};
+    std::atomic_bool shared{false};
+    ShmSegment* segment = nullptr;
+    size_t segmentSize = 0;
+    ShmRingView requestRing;
+    ShmRingView responseRing;
+    std::thread ringThread;
+    std::mutex ringMutex;
+
+    ~Connection()
+    {
+        // Only left running if the ring thread dropped the last reference
+        if (ringThread.joinable())
+            ringThread.detach();
+        if (segment)
+            munmap(segment, segmentSize);
+        for (int payloadFd : fds)
+            close(payloadFd);
+        close(fd);
+    }
+};
+
+// Whether an _RPC::Negotiate asks for a feature; lists may come as dumped
+// strings, like formats
+static bool RequestsFeature(const nlohmann::json& args, const char* feature)
+{
+    auto it = args.find("features");
+    if (it == args.end())
+        return false;
+
+    nlohmann::json features = it->is_string() ? nlohmann::json::parse(it->get<std::string>(), nullptr, false) : *it;
+    return features.is_array() && std::find(features.begin(), features.end(), feature) != features.end();
+}
+
+// Maps a memfd payload, closing fd. Only memfds carrying the seals the
+// client adds are taken, so the file can't change under the mapping;
+// anything else fails F_GET_SEALS.
+static bool MapPayload(int fd, std::shared_ptr<const char>& mapping, size_t& size)
+{
+    constexpr int REQUIRED_SEALS = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE;
+
+    struct stat status;
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || (seals & REQUIRED_SEALS) != REQUIRED_SEALS || fstat(fd, &status) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    size = size_t(status.st_size);
+    void* data = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : nullptr;
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    mapping = std::shared_ptr<const char>((const char*)data, [size](const char* data)
+    {
+        if (data)
+            munmap((void*)data, size);
+    });
+    return true;
+}
+
+RpcServer::RpcServer(int port, int workerThreads, int eventLoops):
+    port(port),
+    workerThreads(workerThreads > 0 ? workerThreads : int(std::max(std::thread::hardware_concurrency(), 1u))),
+    eventLoopCount(eventLoops > 0 ? eventLoops : int(std::max(std::thread::hardware_concurrency(), 1u))),
+    unixPath(UnixSocketPath(port)),
+    unixListener(-1),
+    workers("[RPC Server]"),
+    nextCallbackId(1)
+{
+    running.store(false);
+    nextClientId.store(1);
+
+    methods.push_back({ "", nullptr });
+    AddMethod("_RPC::Batch", nullptr);
+
+    // For clients that don't allocate callback IDs themselves
+    AddMethod("_RPC::AllocateCallback", [this](Connection& connection, const nlohmann::json&, const RpcBlobs&) -> nlohmann::json
+    {
+        std::lock_guard<std::mutex> clientLock(clientMutex);
+        callbackToClientId[nextCallbackId] = connection.clientId;
+        return nextCallbackId++;
+    });
+
+    // Large payloads may come as memfds from then on; see RPC_FLAG_MEMFD.
+    // Kept, like the other _RPC::Enable calls, for clients that predate
+    // features in _RPC::Negotiate.
+    AddMethod("_RPC::EnableFdPayloads", [](Connection& connection, const nlohmann::json&, const RpcBlobs&) -> nlohmann::json
+    {
+        if (!connection.local)
+            throw std::runtime_error("File descriptors need a Unix socket");
+        return 1;
+    });
+
+    // Blob arguments may come as RPC_FLAG_BLOBS sections from then on
+    AddMethod("_RPC::EnableBlobs", [](Connection&, const nlohmann::json&, const RpcBlobs&) -> nlohmann::json
+    {
+        return 1;
+    });
+
+    // Requests after this one come through the client's shared-memory
+    // segment. The reply still goes over the socket, where it is awaited.
+    AddMethod("_RPC::AttachSharedMemory", [this](Connection& connection, const nlohmann::json& args, const RpcBlobs&) -> nlohmann::json
+    {
+        AttachSharedMemory(connection, Argument(args, "name").get<std::string>(), Argument(args, "capacity").get<uint32_t>());
+        return 1;
+    });
+
+    // Requests after this one use CompactRequestHeader; the switch happens
+    // as the request is read
+    AddMethod("_RPC::EnableCompactHeaders", [](Connection&, const nlohmann::json&, const RpcBlobs&) -> nlohmann::json
+    {
+        return 1;
+    });
+
+    // Clients offer format names in order of preference; all are spoken
+    // here. Features asked for alongside are granted in the same reply, and
+    // compact headers were already switched on as the request was read.
+    AddMethod("_RPC::Negotiate", [](Connection& connection, const nlohmann::json& args, const RpcBlobs&) -> nlohmann::json
+    {
+        auto offered = args.find("formats");
+        nlohmann::json formats = offered != args.end() ? *offered : nlohmann::json::array();
+        if (formats.is_string())
+            formats = nlohmann::json::parse(formats.get<std::string>(), nullptr, false);
+
+        WireFormat chosen = WireFormat::JSON;
+        if (formats.is_array())
+        {
+            for (const nlohmann::json& name : formats)
+            {
+                auto it = std::find_if(std::begin(ALL_FORMATS), std::end(ALL_FORMATS),
+                    [&](WireFormat format) { return name == WireFormatName(format); });
+                if (it != std::end(ALL_FORMATS))
+                {
+                    chosen = *it;
+                    break;
+                }
+            }
+        }
+
+        connection.format = chosen;
+        if (!args.contains("features"))
+            return WireFormatName(chosen);
+
+        nlohmann::json granted = nlohmann::json::array();
+        if (RequestsFeature(args, RPC_FEATURE_COMPACT_HEADERS))
+            granted.push_back(RPC_FEATURE_COMPACT_HEADERS);
+        if (RequestsFeature(args, RPC_FEATURE_MEMFD) && connection.local)
+            granted.push_back(RPC_FEATURE_MEMFD);
+        if (RequestsFeature(args, RPC_FEATURE_BLOBS))
+            granted.push_back(RPC_FEATURE_BLOBS);
+        if (RequestsFeature(args, RPC_FEATURE_BATCH))
+            granted.push_back(RPC_FEATURE_BATCH);
+        return {{ "format", WireFormatName(chosen) }, { "features", std::move(granted) }};
+    });
+}
+
+RpcServer::~RpcServer()
+{
+    Stop();
+}
+
+void RpcServer::Register(const std::string& name, Handler handler)
+{
+    AddMethod(name, [handler = std::move(handler)](Connection&, const nlohmann::json& args, const RpcBlobs& blobs)
+    {
+        if (blobs.empty())
+            return handler(args);
+
+        nlohmann::json arrays = args;
+        for (const auto& [key, blob] : blobs)
+            arrays[key] = BlobToArray(blob);
+        return handler(arrays);
+    });
+}
+
+void RpcServer::Register(const std::string& name, BlobHandler handler)
+{
+    AddMethod(name, [handler = std::move(handler)](Connection&, const nlohmann::json& args, const RpcBlobs& blobs)
+    {
+        return handler(args, blobs);
+    });
+}
+
+void RpcServer::AddMethod(const std::string& name, std::function<nlohmann::json(Connection&, const nlohmann::json&, const RpcBlobs&)> invoke)
+{
+    auto [it, added] = methodIds.emplace(name, uint16_t(methods.size()));
+    if (added)
+        methods.push_back({ name, std::move(invoke) });
+    else
+        methods[it->second].invoke = std::move(invoke);
+}
+
+uint16_t RpcServer::FindMethodId(const std::string& name) const
+{
+    auto it = methodIds.find(name);
+    return it != methodIds.end() ? it->second : 0;
+}
+
+const nlohmann::json& RpcServer::Argument(const nlohmann::json& args, const std::string& name)
+{
+    auto it = args.find(name);
+    if (it == args.end())
+        throw std::runtime_error("Missing argument: " + name);
+    return *it;
+}
+
+void RpcServer::Start()
+{
+    unixListener = Listen(AF_UNIX);
+    for (int i = 0; i < eventLoopCount; ++i)
+    {
+        auto loop = std::make_unique<EventLoop>();
+        loop->tcpListener = Listen(AF_INET);
+        SOCKET_CHECK((loop->epollFd = epoll_create1(EPOLL_CLOEXEC)));
+        SOCKET_CHECK((loop->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)));
+
+        // Listeners stay level-triggered; Accept drains them anyway
+        for (int fd : { loop->tcpListener, loop->wakeFd, unixListener })
+        {
+            epoll_event event{};
+            event.events = fd == unixListener ? EPOLLIN | EPOLLEXCLUSIVE : EPOLLIN;
+            event.data.fd = fd;
+            SOCKET_CHECK(epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, fd, &event));
+        }
+        loops.push_back(std::move(loop));
+    }
+
+    workers.Start(workerThreads);
+    running.store(true);
+    for (auto& loop : loops)
+        loop->thread = std::thread(&RpcServer::Run, this, std::ref(*loop));
+    RPC_LOG_INFO("[RPC Server] Listening on port %d and %s with %d event loops", port, unixPath.c_str(), eventLoopCount);
+}
+
+void RpcServer::Stop()
+{
+    if (!running.exchange(false))
+        return;
+
+    uint64_t wake = 1;
+    for (auto& loop : loops)
+        (void)!write(loop->wakeFd, &wake, sizeof(wake));
+    for (auto& loop : loops)
+        loop->thread.join();
+
+    // Handlers still queued fail to write once their sockets are shut down
+    for (auto& loop : loops)
+    {
+        for (auto& [fd, connection] : loop->connections)
+        {
+            shutdown(fd, SHUT_RDWR);
+            StopSharedMemory(*connection);
+        }
+    }
+    workers.Stop();
+
+    for (auto& loop : loops)
+    {
+        loop->connections.clear();
+        close(loop->tcpListener);
+        close(loop->epollFd);
+        close(loop->wakeFd);
+    }
+    loops.clear();
+
+    close(unixListener);
+    unlink(unixPath.c_str());
+    running.notify_all();
+}
+
+void RpcServer::Wait()
+{
+    running.wait(true);
+}
+
+int RpcServer::Listen(int family)
+{
+    int listener;
+    SOCKET_CHECK((listener = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)));
+
+    if (family == AF_INET)
+    {
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (eventLoopCount > 1)
+            SOCKET_CHECK(setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)));
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(port);
+        SOCKET_CHECK(bind(listener, (sockaddr*)&address, sizeof(address)));
+    }
+    else
+    {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, unixPath.c_str(), sizeof(address.sun_path) - 1);
+        unlink(unixPath.c_str());
+        SOCKET_CHECK(bind(listener, (sockaddr*)&address, sizeof(address)));
+    }
+
+    SOCKET_CHECK(listen(listener, SOMAXCONN));
+    return listener;
+}
+
+void RpcServer::Run(EventLoop& loop)
+{
+    auto read = [&](int fd)
+    {
+        auto it = loop.connections.find(fd);
+        if (it == loop.connections.end())
+            return;
+
+        Connection& connection = *it->second;
+        ReadStatus status = ReadRequests(loop, connection);
+        if (status == ReadStatus::Closed)
+        {
+            CloseConnection(loop, fd);
+        }
+        else if (status == ReadStatus::More)
+        {
+            connection.backlogged = true;
+            loop.backlog.push_back(fd);
+        }
+    };
+
+    epoll_event events[64];
+    std::vector<int> backlog;
+    while (true)
+    {
+        // Don't sleep while backlogged connections have bytes waiting
+        int count = epoll_wait(loop.epollFd, events, 64, loop.backlog.empty() ? -1 : 0);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("[RPC Server] epoll_wait");
+            return;
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            int fd = events[i].data.fd;
+            if (fd == loop.wakeFd)
+                return;
+
+            if (fd == loop.tcpListener || fd == unixListener)
+            {
+                Accept(loop, fd);
+                continue;
+            }
+
+            auto it = loop.connections.find(fd);
+            if (it == loop.connections.end())
+                continue;
+
+            if ((events[i].events & EPOLLOUT) && !FlushOutput(*it->second))
+            {
+                CloseConnection(loop, fd);
+                continue;
+            }
+
+            // Backlogged connections are read in their turn below
+            if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && !it->second->backlogged)
+                read(fd);
+        }
+
+        backlog.swap(loop.backlog);
+        for (int fd : backlog)
+        {
+            auto it = loop.connections.find(fd);
+            if (it == loop.connections.end())
+                continue;
+            it->second->backlogged = false;
+            read(fd);
+        }
+        backlog.clear();
+    }
+}
+
+void RpcServer::Accept(EventLoop& loop, int listener)
+{
+    while (true)
+    {
+        int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;     // EAGAIN once the backlog is drained, or another loop took it
+        }
+
+        if (listener == loop.tcpListener)
+        {
+            int noDelay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        }
+
+        auto connection = std::make_shared<Connection>();
+        connection->fd = fd;
+        connection->clientId = nextClientId++;
+        connection->local = listener == unixListener;
+        {
+            std::lock_guard<std::mutex> clientLock(clientMutex);
+            clients[connection->clientId] = connection;
+        }
+        loop.connections[fd] = connection;
+
+        // The greeting tells the client its ID
+        ResponseHeader hello{};
+        hello.clientId = connection->clientId;
+        hello.msgType = ResponseHeader::MsgType::MSG_RETURN;
+        WriteFrame(*connection, hello, std::string());
+
+        // Edge-triggered both ways: reads go until EAGAIN, and queued output
+        // is flushed whenever the socket turns writable
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.fd = fd;
+        SOCKET_CHECK(epoll_ctl(loop.epollFd, EPOLL_CTL_ADD, fd, &event));
+        RPC_LOG_DEBUG("[RPC Server] Client %d connected", connection->clientId);
+    }
+}
+
+void RpcServer::CloseConnection(EventLoop& loop, int fd)
+{
+    auto it = loop.connections.find(fd);
+    std::shared_ptr<Connection> connection = std::move(it->second);
+    loop.connections.erase(it);
+
+    // Workers may still hold the connection; its socket closes with the
+    // last of them, and writes fail until then
+    epoll_ctl(loop.epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    shutdown(fd, SHUT_RDWR);
+    StopSharedMemory(*connection);
+    {
+        std::lock_guard<std::mutex> clientLock(clientMutex);
+        clients.erase(connection->clientId);
+    }
+    RPC_LOG_DEBUG("[RPC Server] Client %d disconnected", connection->clientId);
+}
+
+RpcServer::ReadStatus RpcServer::ReadRequests(EventLoop& loop, Connection& connection)
+{
+    std::shared_ptr<Connection> self = loop.connections[connection.fd];
+
+    for (int reads = 0; reads < READS_PER_TURN; ++reads)
+    {
+        if (connection.inputStart == connection.inputEnd)
+            connection.inputStart = connection.inputEnd = 0;
+
+        // Large frames are read whole instead of chunk by chunk
+        size_t want = READ_CHUNK_SIZE;
+        if (connection.input.size() - connection.inputStart > want)
+            want = std::max(want, connection.input.size() - connection.inputEnd);
+
+        if (connection.input.size() - connection.inputEnd < want)
+        {
+            size_t pending = connection.inputEnd - connection.inputStart;
+            memmove(connection.input.data(), connection.input.data() + connection.inputStart, pending);
+            connection.inputStart = 0;
+            connection.inputEnd = pending;
+            if (connection.input.size() < pending + want)
+                connection.input.resize(pending + want);
+        }
+
+        iovec buffer{ connection.input.data() + connection.inputEnd, connection.input.size() - connection.inputEnd };
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_RECEIVED_FDS)];
+        msghdr message{};
+        message.msg_iov = &buffer;
+        message.msg_iovlen = 1;
+        if (connection.local)
+        {
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+        }
+
+        ssize_t received = recvmsg(connection.fd, &message, MSG_CMSG_CLOEXEC);
+        if (received == 0)
+            return ReadStatus::Closed;
+        if (received < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? ReadStatus::Drained : ReadStatus::Closed;
+        }
+        connection.inputEnd += received;
+
+        // Descriptors arrive with the first byte of the header they belong to
+        for (cmsghdr* rights = CMSG_FIRSTHDR(&message); rights; rights = CMSG_NXTHDR(&message, rights))
+        {
+            if (rights->cmsg_level != SOL_SOCKET || rights->cmsg_type != SCM_RIGHTS)
+                continue;
+            size_t count = (rights->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < count; ++i)
+            {
+                int payloadFd;
+                memcpy(&payloadFd, CMSG_DATA(rights) + i * sizeof(int), sizeof(int));
+                connection.fds.push_back(payloadFd);
+            }
+        }
+        if (message.msg_flags & MSG_CTRUNC)
+        {
+            RPC_LOG_WARNING("[RPC Server] Client %d sent too many descriptors", connection.clientId);
+            return ReadStatus::Closed;
+        }
+
+        while (true)
+        {
+            size_t available = connection.inputEnd - connection.inputStart;
+            const char* data = connection.input.data() + connection.inputStart;
+
+            size_t headerSize = connection.compact ? sizeof(CompactRequestHeader) : sizeof(RpcRequest::header);
+            if (available < headerSize)
+                break;
+
+            Request request;
+            int bufferSize;
+            size_t nameLength;
+            if (!DecodeHeader(connection, data, request, bufferSize, nameLength))
+            {
+                RPC_LOG_WARNING("[RPC Server] Corrupted request header from client %d", connection.clientId);
+                return ReadStatus::Closed;
+            }
+
+            // Attached clients only use the socket to stay connected
+            if (connection.shared)
+            {
+                RPC_LOG_WARNING("[RPC Server] Client %d sent a request around its shared memory", connection.clientId);
+                return ReadStatus::Closed;
+            }
+
+            size_t frameSize = headerSize + nameLength + size_t(bufferSize);
+            if (available < frameSize)
+            {
+                // Make room for the rest of the frame in one go
+                if (connection.input.size() - connection.inputStart < frameSize)
+                    connection.input.resize(connection.inputStart + frameSize);
+                break;
+            }
+
+            ResolveName(connection, request, data + headerSize, nameLength);
+            request.payload.assign(data + headerSize + nameLength, bufferSize);
+            connection.inputStart += frameSize;
+
+            if (request.flags & RPC_FLAG_MEMFD)
+            {
+                if (connection.fds.empty())
+                {
+                    RPC_LOG_WARNING("[RPC Server] Client %d sent a memfd request without a memfd", connection.clientId);
+                    return ReadStatus::Closed;
+                }
+
+                int payloadFd = connection.fds.front();
+                connection.fds.pop_front();
+                if (!MapPayload(payloadFd, request.mapping, request.mappingSize))
+                {
+                    RPC_LOG_WARNING("[RPC Server] Client %d sent an unusable memfd", connection.clientId);
+                    return ReadStatus::Closed;
+                }
+            }
+
+            // The reply is still a full ResponseHeader, as ever
+            if (!connection.compact && SwitchesToCompact(connection, request))
+                connection.compact = true;
+
+            Enqueue(self, std::move(request));
+        }
+    }
+    return ReadStatus::More;
+}
+
+bool RpcServer::DecodeHeader(const Connection& connection, const char* data, Request& request, int& bufferSize, size_t& nameLength) const
+{
+    nameLength = 0;
+    if (connection.compact)
+    {
+        CompactRequestHeader header;
+        memcpy(&header, data, sizeof(header));
+        request.requestId = header.requestId;
+        request.flags = header.flags;
+        request.methodId = header.methodId;
+        nameLength = header.methodId == 0 ? header.nameLength : 0;
+        bufferSize = header.bufferSize;
+    }
+    else
+    {
+        decltype(RpcRequest::header) header;
+        memcpy(&header, data, sizeof(header));
+        request.requestId = header.requestId;
+        request.flags = header.flags;
+        request.name.assign(header.functionName, strnlen(header.functionName, sizeof(header.functionName)));
+        request.methodId = FindMethodId(request.name);
+        bufferSize = header.bufferSize;
+    }
+    return bufferSize >= 0 && bufferSize <= MAX_REQUEST_SIZE;
+}
+
+bool RpcServer::SwitchesToCompact(Connection& connection, const Request& request)
+{
+    if (request.name == "_RPC::EnableCompactHeaders")
+        return true;
+    if (request.name != "_RPC::Negotiate" || GetWireFormat(request.flags) != WireFormat::JSON)
+        return false;
+
+    // Parsed again when it runs; that happens once per connection
+    try
+    {
+        return RequestsFeature(ParseArgs(connection, WireFormat::JSON, request.payload), RPC_FEATURE_COMPACT_HEADERS);
+    }
+    catch (const std::exception&)
+    {
+        return false;
+    }
+}
+
+void RpcServer::ResolveName(const Connection& connection, Request& request, const char* name, size_t nameLength) const
+{
+    request.resolvedId = 0;
+    if (connection.compact && request.methodId == 0)
+    {
+        request.name.assign(name, nameLength);
+        request.methodId = FindMethodId(request.name);
+        request.resolvedId = request.methodId;
+    }
+    else if (connection.compact)
+    {
+        request.name = request.methodId < methods.size() ? methods[request.methodId].name : "#" + std::to_string(request.methodId);
+    }
+}
+
+void RpcServer::AttachSharedMemory(Connection& connection, const std::string& name, uint32_t capacity)
+{
+    // The segment is the client's, so it has to be on this machine
+    sockaddr_storage peer{};
+    socklen_t peerSize = sizeof(peer);
+    bool loopback = connection.local;
+    if (!loopback && getpeername(connection.fd, (sockaddr*)&peer, &peerSize) == 0 && peer.ss_family == AF_INET)
+        loopback = (ntohl(((sockaddr_in*)&peer)->sin_addr.s_addr) >> 24) == IN_LOOPBACKNET;
+    if (!loopback)
+        throw std::runtime_error("Shared memory needs a local client");
+
+    if (name.rfind(SHM_NAME_PREFIX, 0) != 0 || name.find('/', 1) != std::string::npos)
+        throw std::runtime_error("Not a shared memory segment name: " + name);
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0 || capacity > (1u << 30))
+        throw std::runtime_error("Bad ring capacity");
+    if (connection.shared)
+        throw std::runtime_error("Shared memory is already attached");
+
+    // The client creates the segment 0600, so only a client running as
+    // the same user gets this far
+    int fd = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0)
+        throw std::runtime_error("Can't open " + name + ": " + strerror(errno));
+
+    size_t size = ShmSegmentSize(capacity);
+    struct stat status;
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &status) == 0 && size_t(status.st_size) == size)
+        mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("Can't map " + name);
+
+    ShmSegment* segment = static_cast<ShmSegment*>(mapping);
+    bool valid = segment->magic == SHM_MAGIC && segment->version == SHM_VERSION
+        && segment->requestRing.capacity == capacity && segment->requestRing.dataOffset == sizeof(ShmSegment)
+        && segment->responseRing.capacity == capacity && segment->responseRing.dataOffset == sizeof(ShmSegment) + capacity;
+    if (!valid)
+    {
+        munmap(mapping, size);
+        throw std::runtime_error("Bad shared memory segment");
+    }
+
+    std::shared_ptr<Connection> self;
+    {
+        std::lock_guard<std::mutex> clientLock(clientMutex);
+        auto client = clients.find(connection.clientId);
+        if (client != clients.end())
+            self = client->second.lock();
+    }
+
+    std::lock_guard<std::mutex> writeLock(connection.writeMutex);
+    if (!self || connection.closed)
+    {
+        munmap(mapping, size);
+        throw std::runtime_error("Client is gone");
+    }
+    connection.segment = segment;
+    connection.segmentSize = size;
+    connection.requestRing = ShmRequestView(segment, capacity);
+    connection.responseRing = ShmResponseView(segment, capacity);
+    connection.shared = true;
+    connection.ringThread = std::thread(&RpcServer::ReadSharedMemory, this, std::move(self));
+    RPC_LOG_DEBUG("[RPC Server] Client %d attached %s", connection.clientId, name.c_str());
+}
+
+void RpcServer::ReadSharedMemory(std::shared_ptr<Connection> self)
+{
+    Connection& connection = *self;
+    const ShmRingView& ring = connection.requestRing;
+    std::function<bool()> alive = [&connection]() { return !connection.closed.load(); };
+
+    // Same frames as on the socket, read straight out of the ring
+    std::vector<char> name;
+    while (true)
+    {
+        char header[sizeof(RpcRequest::header)];
+        size_t headerSize = connection.compact ? sizeof(CompactRequestHeader) : sizeof(RpcRequest::header);
+        if (!ShmRingRead(ring, header, headerSize, alive))
+            break;
+
+        Request request;
+        int bufferSize;
+        size_t nameLength;
+        if (!DecodeHeader(connection, header, request, bufferSize, nameLength) || (request.flags & RPC_FLAG_MEMFD))
+        {
+            RPC_LOG_WARNING("[RPC Server] Corrupted request header from client %d", connection.clientId);
+            break;
+        }
+
+        name.resize(nameLength);
+        request.payload.resize(bufferSize);
+        if (!ShmRingRead(ring, name.data(), nameLength, alive) || !ShmRingRead(ring, request.payload.data(), bufferSize, alive))
+            break;
+        ResolveName(connection, request, name.data(), nameLength);
+        request.viaRing = true;
+
+        if (!connection.compact && SwitchesToCompact(connection, request))
+            connection.compact = true;
+
+        Enqueue(self, std::move(request));
+    }
+
+    // The event loop sees the socket close and cleans up
+    shutdown(connection.fd, SHUT_RDWR);
+}
+
+void RpcServer::StopSharedMemory(Connection& connection)
+{
+    connection.closed = true;
+
+    std::thread ringThread;
+    {
+        std::lock_guard<std::mutex> writeLock(connection.writeMutex);
+        if (connection.segment)
+        {
+            ShmRingClose(connection.segment->requestRing);
+            ShmRingClose(connection.segment->responseRing);
+        }
+        ringThread = std::move(connection.ringThread);
+    }
+    if (ringThread.joinable())
+        ringThread.join();
+}
+
+void RpcServer::Enqueue(const std::shared_ptr<Connection>& self, Request request)
+{
+    {
+        std::lock_guard<std::mutex> requestLock(self->requestMutex);
+        self->requests.push_back(std::move(request));
+        if (self->draining)
+            return;
+        self->draining = true;
+    }
+    workers.Post([this, self]() { Drain(self); });
+}
+
+void RpcServer::Drain(std::shared_ptr<Connection> self)
+{
+    for (int handled = 0; ; ++handled)
+    {
+        Request request;
+        {
+            std::lock_guard<std::mutex> requestLock(self->requestMutex);
+            if (self->requests.empty())
+            {
+                self->draining = false;
+                return;
+            }
+
+            // Gives the worker back now and then, so one busy client can't
+            // keep it from the others
+            if (handled == REQUESTS_PER_TURN)
+                break;
+            request = std::move(self->requests.front());
+            self->requests.pop_front();
+        }
+        Handle(*self, request);
+    }
+    workers.Post([this, self]() { Drain(self); });
+}
+
+void RpcServer::Handle(Connection& connection, Request& request)
+{
+    WireFormat format = GetWireFormat(request.flags);
+    int status = 0;
+    std::string_view payload = request.mapping ? std::string_view(request.mapping.get(), request.mappingSize) : request.payload;
+    nlohmann::json result = Dispatch(connection, request.methodId, request.name, request.flags, payload, status);
+    if (request.flags & RPC_FLAG_ONEWAY)
+        return;
+
+    std::string response = EncodeResult(format, result);
+
+    ResponseHeader header{};
+    header.clientId = connection.clientId;
+    header.requestId = request.requestId;
+    header.msgType = ResponseHeader::MsgType::MSG_RETURN;
+    header.flags = uint8_t(format);
+    header.methodId = request.resolvedId;
+    header.u.statusCode = status;
+    header.bufferSize = int(response.size());
+    if (request.viaRing)
+        WriteSharedFrame(connection, header, response);
+    else
+        WriteFrame(connection, header, response);
+}
+
+nlohmann::json RpcServer::Dispatch(Connection& connection, uint16_t methodId, const std::string& name, uint8_t flags, std::string_view payload, int& status)
+{
+    try
+    {
+        WireFormat format = GetWireFormat(flags);
+
+        // Blob markers point into the whole payload; the document is at its end
+        std::string_view blobSection;
+        if (flags & RPC_FLAG_BLOBS)
+        {
+            blobSection = payload;
+            if (format == WireFormat::JSON || !BlobDocument(blobSection, payload))
+                throw std::runtime_error("Malformed blob payload");
+        }
+
+        if (methodId == BATCH_METHOD_ID)
+            return DispatchBatch(connection, format, payload, blobSection);
+
+        if (methodId == 0 || methodId >= methods.size() || !methods[methodId].invoke)
+            throw std::runtime_error("Unknown function: " + name);
+        nlohmann::json args = ParseArgs(connection, format, payload);
+        return methods[methodId].invoke(connection, args, ResolveBlobs(args, blobSection));
+    }
+    catch (const std::exception& e)
+    {
+        RPC_LOG_DEBUG("[RPC Server] Client %d: %s failed: %s", connection.clientId, name.c_str(), e.what());
+        status = 1;
+        return e.what();
+    }
+}
+
+nlohmann::json RpcServer::DispatchBatch(Connection& connection, WireFormat format, std::string_view payload, std::string_view blobSection)
+{
+    if (format == WireFormat::JSON)
+        throw std::runtime_error("Batches need a negotiated wire format");
+
+    // {"calls":[{"function":...,"args":{...},"callbacks":[...]}]}, answered
+    // with [{"status":...,"result":...}]. Entries fail independently.
+    nlohmann::json document = DecodePayload(format, payload);
+    if (!document.is_object() || !document.contains("calls") || !document["calls"].is_array())
+        throw std::runtime_error("Malformed batch");
+
+    nlohmann::json results = nlohmann::json::array();
+    for (const nlohmann::json& call : document["calls"])
+    {
+        nlohmann::json entry;
+        try
+        {
+            if (!call.is_object() || !call.contains("function") || !call["function"].is_string())
+                throw std::runtime_error("Malformed batch entry");
+
+            std::string name = call["function"];
+            uint16_t methodId = FindMethodId(name);
+            if (methodId == 0 || !methods[methodId].invoke)
+                throw std::runtime_error("Unknown function: " + name);
+
+            nlohmann::json args = ParseDocumentArgs(connection, call);
+            entry["result"] = methods[methodId].invoke(connection, args, ResolveBlobs(args, blobSection));
+            entry["status"] = 0;
+        }
+        catch (const std::exception& e)
+        {
+            entry["result"] = e.what();
+            entry["status"] = 1;
+        }
+        results.push_back(std::move(entry));
+    }
+    return results;
+}
+
+nlohmann::json RpcServer::ParseArgs(Connection& connection, WireFormat format, std::string_view payload)
+{
+    if (format != WireFormat::JSON)
+        return ParseDocumentArgs(connection, DecodePayload(format, payload));
+
+    // {"keys":[...],"values":[dumped values],"callbacks":[...]}
+    nlohmann::json wrapped = nlohmann::json::parse(payload.begin(), payload.end(), nullptr, false);
+    if (!wrapped.is_object())
+        throw std::runtime_error("Malformed arguments");
+
+    if (wrapped.contains("callbacks"))
+        RegisterCallbacks(connection, wrapped["callbacks"]);
+
+    nlohmann::json args = nlohmann::json::object();
+    const nlohmann::json& keys = wrapped.value("keys", nlohmann::json::array());
+    const nlohmann::json& values = wrapped.value("values", nlohmann::json::array());
+    for (size_t i = 0; i < keys.size() && i < values.size(); ++i)
+    {
+        if (!keys[i].is_string() || !values[i].is_string())
+            throw std::runtime_error("Malformed arguments");
+
+        const std::string& value = values[i].get_ref<const std::string&>();
+        nlohmann::json parsed = nlohmann::json::parse(value, nullptr, false);
+        args[keys[i].get<std::string>()] = parsed.is_discarded() ? nlohmann::json(value) : std::move(parsed);
+    }
+    return args;
+}
+
+nlohmann::json RpcServer::ParseDocumentArgs(Connection& connection, const nlohmann::json& document)
+{
+    // {"args":{...},"callbacks":[...]}
+    if (!document.is_object())
+        throw std::runtime_error("Malformed arguments");
+
+    auto callbacks = document.find("callbacks");
+    if (callbacks != document.end())
+        RegisterCallbacks(connection, *callbacks);
+
+    auto args = document.find("args");
+    if (args != document.end() && args->is_object())
+        return *args;
+    return nlohmann::json::object();
+}
+
+void RpcServer::RegisterCallbacks(Connection& connection, const nlohmann::json& callbacks)
+{
+    if (!callbacks.is_array())
+        return;
+
+    // Client-allocated IDs carry the owning client ID in their upper 32 bits
+    std::lock_guard<std::mutex> clientLock(clientMutex);
+    for (const nlohmann::json& id : callbacks)
+    {
+        if (!id.is_number_integer())
+            continue;
+        int64_t callbackId = id.get<int64_t>();
+        if (int(callbackId >> 32) == connection.clientId)
+            callbackToClientId[callbackId] = connection.clientId;
+    }
+}
+
+RpcBlobs RpcServer::ResolveBlobs(const nlohmann::json& args, std::string_view blobSection)
+{
+    // Views into args for inline markers, and into the payload for the rest
+    RpcBlobs blobs;
+    if (!args.is_object())
+        return blobs;
+
+    for (const auto& [name, value] : args.items())
+    {
+        if (IsBlob(value))
+            blobs.emplace(name, ResolveBlob(value, blobSection));
+    }
+    return blobs;
+}
+
+std::string RpcServer::EncodeResult(WireFormat format, const nlohmann::json& result)
+{
+    if (format != WireFormat::JSON)
+        return EncodePayload(format, {{ "result", result }});
+
+    // {"result":"<string>"}, the way the C# server writes it
+    std::string text;
+    if (result.is_string())
+        text = result.get<std::string>();
+    else if (!result.is_null())
+        text = result.dump();
+    return nlohmann::json{{ "result", text }}.dump();
+}
+
+bool RpcServer::TriggerCallback(int64_t callbackId, const nlohmann::json& namedArgs)
+{
+    std::shared_ptr<Connection> connection;
+    {
+        std::lock_guard<std::mutex> clientLock(clientMutex);
+        auto owner = callbackToClientId.find(callbackId);
+        if (owner == callbackToClientId.end())
+            return false;
+        auto client = clients.find(owner->second);
+        if (client != clients.end())
+            connection = client->second.lock();
+    }
+    if (!connection)
+        return false;
+
+    WireFormat format = connection->format;
+    std::string payload;
+    if (format != WireFormat::JSON)
+    {
+        payload = EncodePayload(format, namedArgs);
+    }
+    else
+    {
+        // {"keys":[...],"values":[...]}; strings go as they are
+        nlohmann::json keys = nlohmann::json::array();
+        nlohmann::json values = nlohmann::json::array();
+        for (const auto& [key, value] : namedArgs.items())
+        {
+            keys.push_back(key);
+            values.push_back(value.is_string() ? value.get<std::string>() : value.dump());
+        }
+        payload = nlohmann::json{{ "keys", keys }, { "values", values }}.dump();
+    }
+
+    // The client rebuilds the full ID from the header's clientId
+    ResponseHeader header{};
+    header.clientId = connection->clientId;
+    header.msgType = ResponseHeader::MsgType::MSG_CALLBACK;
+    header.flags = uint8_t(format);
+    header.u.callbackId = int(uint32_t(callbackId));
+    header.bufferSize = int(payload.size());
+    if (connection->shared)
+        return WriteSharedFrame(*connection, header, payload);
+    return WriteFrame(*connection, header, payload);
+}
+
+bool RpcServer::WriteFrame(Connection& connection, const ResponseHeader& header, const std::string& payload)
+{
+    size_t frameSize = sizeof(header) + payload.size();
+    size_t sent = 0;
+
+    std::lock_guard<std::mutex> writeLock(connection.writeMutex);
+    if (connection.outputStart == connection.output.size())
+    {
+        iovec buffers[] = {
+            { (void*)&header, sizeof(header) },
+            { (void*)payload.data(), payload.size() }
+        };
+        msghdr message{};
+        message.msg_iov = buffers;
+        message.msg_iovlen = 2;
+
+        ssize_t result;
+        do
+            result = sendmsg(connection.fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+        while (result < 0 && errno == EINTR);
+
+        if (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            return false;
+        sent = result < 0 ? 0 : size_t(result);
+        if (sent == frameSize)
+            return true;
+    }
+
+    // The event loop sends the rest once the socket drains. It flushes
+    // under this lock, so the queue can't be missed between the failed
+    // send above and the append below.
+    if (connection.output.size() - connection.outputStart + frameSize - sent > MAX_OUTPUT_SIZE)
+    {
+        RPC_LOG_WARNING("[RPC Server] Client %d is not reading; dropping it", connection.clientId);
+        shutdown(connection.fd, SHUT_RDWR);
+        return false;
+    }
+
+    if (sent < sizeof(header))
+        connection.output.append((const char*)&header + sent, sizeof(header) - sent);
+    connection.output.append(payload, sent > sizeof(header) ? sent - sizeof(header) : 0);
+    return true;
+}
+
+bool RpcServer::WriteSharedFrame(Connection& connection, const ResponseHeader& header, const std::string& payload)
+{
+    // Closing the connection closes the ring, which wakes a blocked writer
+    std::function<bool()> alive = [&connection]() { return !connection.closed.load(); };
+    const ShmRingView& ring = connection.responseRing;
+
+    std::lock_guard<std::mutex> ringLock(connection.ringMutex);
+    return ShmRingWrite(ring, &header, sizeof(header), alive)
+        && ShmRingWrite(ring, payload.data(), payload.size(), alive);
+}
+
+bool RpcServer::FlushOutput(Connection& connection)
+{
+    std::lock_guard<std::mutex> writeLock(connection.writeMutex);
+    while (connection.outputStart < connection.output.size())
+    {
+        ssize_t sent = send(connection.fd, connection.output.data() + connection.outputStart,
+            connection.output.size() - connection.outputStart, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        connection.outputStart += sent;
+    }
+
+    // Don't keep a burst's worth of memory around per idle connection
+    connection.outputStart = 0;
+    if (connection.output.capacity() > READ_CHUNK_SIZE)
+        std::string().swap(connection.output);
+    else
+        connection.output.clear();
+    return true;
+}
+
+#endif
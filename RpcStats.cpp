@@ -0,0 +1,168 @@
+#include "RpcStats.h"
+
+#include <algorithm>
+#include <bit>
+#include <map>
+
+static std::atomic_uint64_t nextStatsId{1};
+
+// Single writer per shard, so no read-modify-write instruction is needed
+static void Add(std::atomic_uint64_t& counter, uint64_t value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+int LatencyHistogram::BucketOf(uint64_t value)
+{
+    if (value < uint64_t(SUB_BUCKETS))
+        return int(value);
+
+    int shift = std::min(63 - std::countl_zero(value), MAX_VALUE_BITS - 1) - SUB_BUCKET_BITS;
+    uint64_t top = std::min(value >> shift, uint64_t(2 * SUB_BUCKETS - 1));
+    return (shift + 1) * SUB_BUCKETS + int(top - SUB_BUCKETS);
+}
+
+uint64_t LatencyHistogram::HighestValueOf(int bucket)
+{
+    if (bucket < SUB_BUCKETS)
+        return uint64_t(bucket);
+
+    int shift = bucket / SUB_BUCKETS - 1;
+    uint64_t top = uint64_t(bucket % SUB_BUCKETS + SUB_BUCKETS);
+    return ((top + 1) << shift) - 1;
+}
+
+LatencyHistogram::LatencyHistogram(): buckets(BUCKET_COUNT), count(0), total(0), max(0)
+{
+}
+
+void LatencyHistogram::Record(uint64_t value)
+{
+    ++buckets[BucketOf(value)];
+    ++count;
+    total += value;
+    max = std::max(max, value);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other)
+{
+    for (int i = 0; i < BUCKET_COUNT; ++i)
+        buckets[i] += other.buckets[i];
+    count += other.count;
+    total += other.total;
+    max = std::max(max, other.max);
+}
+
+uint64_t LatencyHistogram::Percentile(double percent) const
+{
+    if (count == 0)
+        return 0;
+
+    uint64_t rank = uint64_t(percent / 100.0 * count + 0.5);
+    rank = std::clamp<uint64_t>(rank, 1, count);
+
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+            return std::min(HighestValueOf(i), max);
+    }
+    return max;
+}
+
+
+RpcStats::RpcStats(): id(nextStatsId++)
+{
+}
+
+RpcStats::Shard& RpcStats::LocalShard()
+{
+    // Threads nearly always talk to one client, so one cached shard will do
+    thread_local uint64_t cachedId = 0;
+    thread_local Shard* cached = nullptr;
+    if (cachedId == id)
+        return *cached;
+
+    std::lock_guard<std::mutex> shardLock(shardMutex);
+    Shard*& shard = shardsByThread[std::this_thread::get_id()];
+    if (!shard)
+    {
+        shards.push_back(std::make_unique<Shard>());
+        shard = shards.back().get();
+    }
+
+    cachedId = id;
+    cached = shard;
+    return *shard;
+}
+
+std::pair<const std::string, std::unique_ptr<RpcStats::Counters>>& RpcStats::Find(Shard& shard, std::string_view function)
+{
+    // Only this thread inserts, so looking up without the lock is safe
+    auto it = shard.functions.find(function);
+    if (it != shard.functions.end())
+        return *it;
+
+    std::lock_guard<std::mutex> mapLock(shard.mutex);
+    return *shard.functions.emplace(std::string(function), std::make_unique<Counters>()).first;
+}
+
+const std::string& RpcStats::RecordSend(std::string_view function, uint64_t bytes)
+{
+    auto& [name, counters] = Find(LocalShard(), function);
+    Add(counters->calls, 1);
+    Add(counters->bytesSent, bytes);
+    return name;
+}
+
+void RpcStats::RecordReturn(const std::string& function, std::chrono::nanoseconds latency, uint64_t bytes, bool error)
+{
+    Counters& counters = *Find(LocalShard(), function).second;
+    uint64_t nanoseconds = uint64_t(std::max<int64_t>(latency.count(), 0));
+
+    Add(counters.bytesReceived, bytes);
+    Add(counters.totalNanoseconds, nanoseconds);
+    Add(counters.buckets[LatencyHistogram::BucketOf(nanoseconds)], 1);
+    if (error)
+        Add(counters.errors, 1);
+    if (nanoseconds > counters.maxNanoseconds.load(std::memory_order_relaxed))
+        counters.maxNanoseconds.store(nanoseconds, std::memory_order_relaxed);
+}
+
+std::vector<FunctionStats> RpcStats::Snapshot()
+{
+    std::map<std::string, FunctionStats> merged;
+
+    std::lock_guard<std::mutex> shardLock(shardMutex);
+    for (const std::unique_ptr<Shard>& shard : shards)
+    {
+        std::lock_guard<std::mutex> mapLock(shard->mutex);
+        for (const auto& [name, counters] : shard->functions)
+        {
+            FunctionStats& stats = merged[name];
+            stats.function = name;
+            stats.calls += counters->calls.load(std::memory_order_relaxed);
+            stats.errors += counters->errors.load(std::memory_order_relaxed);
+            stats.bytesSent += counters->bytesSent.load(std::memory_order_relaxed);
+            stats.bytesReceived += counters->bytesReceived.load(std::memory_order_relaxed);
+
+            LatencyHistogram& latency = stats.latency;
+            for (int i = 0; i < LatencyHistogram::BUCKET_COUNT; ++i)
+            {
+                // Counted from the buckets so percentiles always add up
+                uint64_t samples = counters->buckets[i].load(std::memory_order_relaxed);
+                latency.buckets[i] += samples;
+                latency.count += samples;
+            }
+            latency.total += counters->totalNanoseconds.load(std::memory_order_relaxed);
+            latency.max = std::max(latency.max, counters->maxNanoseconds.load(std::memory_order_relaxed));
+        }
+    }
+
+    std::vector<FunctionStats> snapshot;
+    snapshot.reserve(merged.size());
+    for (auto& [name, stats] : merged)
+        snapshot.push_back(std::move(stats));
+    return snapshot;
+}
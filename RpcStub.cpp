@@ -0,0 +1,506 @@
+#include "RpcStub.h"
+
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+
+// Appends value as the body of a JSON string, without the quotes
+static void EscapeJson(std::string& out, std::string_view value)
+{
+    static const char hex[] = "0123456789abcdef";
+    for (char c : value)
+    {
+        switch (c)
+        {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\b': out += "\\b"; break;
+        case '\f': out += "\\f"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if ((unsigned char)c < 0x20)
+            {
+                out += "\\u00";
+                out += hex[(c >> 4) & 0xf];
+                out += hex[c & 0xf];
+            }
+            else
+            {
+                out += c;
+            }
+        }
+    }
+}
+
+// NaN and infinities have no JSON spelling; they go as null, like nlohmann's dump
+template <typename T>
+static void AppendNumber(std::string& out, T value)
+{
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        if (!std::isfinite(value))
+        {
+            out += "null";
+            return;
+        }
+    }
+
+    char buffer[32];
+    auto [end, error] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, end);
+}
+
+PayloadWriter::PayloadWriter(WireFormat format): format(format), first(true)
+{
+}
+
+void PayloadWriter::BeginArgs(size_t count)
+{
+    switch (format)
+    {
+    case WireFormat::MessagePack:
+        payload += char(0x81);
+        String("args");
+        if (count < 16)
+        {
+            payload += char(0x80 | count);
+        }
+        else
+        {
+            payload += char(0xdf);
+            BigEndian(count, 4);
+        }
+        break;
+    case WireFormat::CBOR:
+        payload += char(0xa1);
+        String("args");
+        Head(5, count);
+        break;
+    case WireFormat::NativeJSON:
+        payload += "{\"args\":{";
+        break;
+    case WireFormat::JSON:
+        payload += "{\"keys\":[";
+        values += "],\"values\":[";
+        break;
+    }
+}
+
+void PayloadWriter::Key(std::string_view name)
+{
+    switch (format)
+    {
+    case WireFormat::MessagePack:
+    case WireFormat::CBOR:
+        String(name);
+        break;
+    case WireFormat::NativeJSON:
+        if (!first)
+            payload += ',';
+        String(name);
+        payload += ':';
+        break;
+    case WireFormat::JSON:
+        // Each value is its JSON dump, quoted once more
+        if (!first)
+        {
+            payload += ',';
+            values += ',';
+        }
+        String(name);
+        values += '"';
+        break;
+    }
+    first = false;
+}
+
+void PayloadWriter::Arg(std::string_view name, int64_t value)
+{
+    Key(name);
+    switch (format)
+    {
+    case WireFormat::MessagePack:
+        if (value >= -32 && value < 128)
+        {
+            payload += char(value);
+        }
+        else
+        {
+            payload += char(0xd3);
+            BigEndian(uint64_t(value), 8);
+        }
+        break;
+    case WireFormat::CBOR:
+        if (value >= 0)
+            Head(0, uint64_t(value));
+        else
+            Head(1, uint64_t(-1 - value));
+        break;
+    case WireFormat::NativeJSON:
+        AppendNumber(payload, value);
+        break;
+    case WireFormat::JSON:
+        AppendNumber(values, value);
+        values += '"';
+        break;
+    }
+}
+
+void PayloadWriter::Arg(std::string_view name, uint64_t value)
+{
+    if (value <= uint64_t(INT64_MAX))
+    {
+        Arg(name, int64_t(value));
+        return;
+    }
+
+    Key(name);
+    switch (format)
+    {
+    case WireFormat::MessagePack:
+        payload += char(0xcf);
+        BigEndian(value, 8);
+        break;
+    case WireFormat::CBOR:
+        Head(0, value);
+        break;
+    case WireFormat::NativeJSON:
+        AppendNumber(payload, value);
+        break;
+    case WireFormat::JSON:
+        AppendNumber(values, value);
+        values += '"';
+        break;
+    }
+}
+
+void PayloadWriter::Arg(std::string_view name, double value)
+{
+    Key(name);
+    switch (format)
+    {
+    case WireFormat::MessagePack:
+    case WireFormat::CBOR:
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        payload += char(format == WireFormat::MessagePack ? 0xcb : 0xfb);
+        BigEndian(bits, 8);
+        break;
+    }
+    case WireFormat::NativeJSON:
+        AppendNumber(payload, value);
+        break;
+    case WireFormat::JSON:
+        AppendNumber(values, value);
+        values += '"';
+        break;
+    }
+}
+
+void PayloadWriter::Arg(std::string_view name, bool value)
+{
+    Key(name);
+    switch (format)
+    {
+    case WireFormat::MessagePack:
+        payload += char(value ? 0xc3 : 0xc2);
+        break;
+    case WireFormat::CBOR:
+        payload += char(value ? 0xf5 : 0xf4);
+        break;
+    case WireFormat::NativeJSON:
+        payload += value ? "true" : "false";
+        break;
+    case WireFormat::JSON:
+        values += value ? "true\"" : "false\"";
+        break;
+    }
+}
+
+void PayloadWriter::Arg(std::string_view name, std::string_view value)
+{
+    Key(name);
+    if (format != WireFormat::JSON)
+    {
+        String(value);
+        return;
+    }
+
+    std::string dumped = "\"";
+    EscapeJson(dumped, value);
+    dumped += '"';
+    EscapeJson(values, dumped);
+    values += '"';
+}
+
+void PayloadWriter::Arg(std::string_view name, const nlohmann::json& value)
+{
+    Key(name);
+    switch (format)
+    {
+    case WireFormat::MessagePack:
+    {
+        std::vector<uint8_t> bytes = nlohmann::json::to_msgpack(value);
+        payload.append(bytes.begin(), bytes.end());
+        break;
+    }
+    case WireFormat::CBOR:
+    {
+        std::vector<uint8_t> bytes = nlohmann::json::to_cbor(value);
+        payload.append(bytes.begin(), bytes.end());
+        break;
+    }
+    case WireFormat::NativeJSON:
+        payload += value.dump();
+        break;
+    case WireFormat::JSON:
+        EscapeJson(values, value.dump());
+        values += '"';
+        break;
+    }
+}
+
+std::string PayloadWriter::Finish()
+{
+    if (format == WireFormat::NativeJSON)
+    {
+        payload += "}}";
+    }
+    else if (format == WireFormat::JSON)
+    {
+        payload += values;
+        payload += "]}";
+    }
+    return std::move(payload);
+}
+
+void PayloadWriter::Head(int major, uint64_t argument)
+{
+    char type = char(major << 5);
+    if (argument < 24)
+    {
+        payload += char(type | argument);
+    }
+    else if (argument <= 0xff)
+    {
+        payload += char(type | 24);
+        BigEndian(argument, 1);
+    }
+    else if (argument <= 0xffff)
+    {
+        payload += char(type | 25);
+        BigEndian(argument, 2);
+    }
+    else if (argument <= 0xffffffff)
+    {
+        payload += char(type | 26);
+        BigEndian(argument, 4);
+    }
+    else
+    {
+        payload += char(type | 27);
+        BigEndian(argument, 8);
+    }
+}
+
+void PayloadWriter::String(std::string_view value)
+{
+    switch (format)
+    {
+    case WireFormat::MessagePack:
+        if (value.size() < 32)
+        {
+            payload += char(0xa0 | value.size());
+        }
+        else
+        {
+            payload += char(0xdb);
+            BigEndian(value.size(), 4);
+        }
+        payload += value;
+        break;
+    case WireFormat::CBOR:
+        Head(3, value.size());
+        payload += value;
+        break;
+    default:
+        payload += '"';
+        EscapeJson(payload, value);
+        payload += '"';
+        break;
+    }
+}
+
+void PayloadWriter::BigEndian(uint64_t value, int size)
+{
+    for (int shift = (size - 1) * 8; shift >= 0; shift -= 8)
+        payload += char(value >> shift);
+}
+
+
+PayloadReader::PayloadReader(WireFormat format, const std::string& payload):
+    format(format), payload(payload), offset(0)
+{
+    // {"result": <value>}
+    Expect(Byte() == (format == WireFormat::MessagePack ? 0x81 : 0xa1));
+    Expect(String() == "result");
+}
+
+void PayloadReader::Expect(bool condition)
+{
+    if (!condition)
+        throw std::runtime_error("[RPC Client] Result does not match the bound return type.");
+}
+
+uint8_t PayloadReader::Byte()
+{
+    Expect(offset < payload.size());
+    return uint8_t(payload[offset++]);
+}
+
+uint64_t PayloadReader::BigEndian(int size)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < size; ++i)
+        value = (value << 8) | Byte();
+    return value;
+}
+
+uint64_t PayloadReader::Argument(uint8_t info)
+{
+    if (info < 24)
+        return info;
+    Expect(info <= 27);
+    return BigEndian(1 << (info - 24));
+}
+
+bool PayloadReader::Bool()
+{
+    uint8_t b = Byte();
+    if (format == WireFormat::MessagePack)
+    {
+        Expect(b == 0xc2 || b == 0xc3);
+        return b == 0xc3;
+    }
+    Expect(b == 0xf4 || b == 0xf5);
+    return b == 0xf5;
+}
+
+bool PayloadReader::Number(double& d, int64_t& i)
+{
+    uint8_t b = Byte();
+    if (format == WireFormat::MessagePack)
+    {
+        if (b < 0x80 || b >= 0xe0)
+        {
+            i = int8_t(b);
+            return true;
+        }
+        switch (b)
+        {
+        case 0xcc: i = int64_t(BigEndian(1)); return true;
+        case 0xcd: i = int64_t(BigEndian(2)); return true;
+        case 0xce: i = int64_t(BigEndian(4)); return true;
+        case 0xcf: i = int64_t(BigEndian(8)); return true;
+        case 0xd0: i = int8_t(BigEndian(1)); return true;
+        case 0xd1: i = int16_t(BigEndian(2)); return true;
+        case 0xd2: i = int32_t(BigEndian(4)); return true;
+        case 0xd3: i = int64_t(BigEndian(8)); return true;
+        case 0xca:
+        {
+            uint32_t bits = uint32_t(BigEndian(4));
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            d = f;
+            return false;
+        }
+        case 0xcb:
+        {
+            uint64_t bits = BigEndian(8);
+            memcpy(&d, &bits, sizeof(d));
+            return false;
+        }
+        }
+        Expect(false);
+    }
+
+    int major = b >> 5;
+    if (major == 0)
+    {
+        i = int64_t(Argument(b & 0x1f));
+        return true;
+    }
+    if (major == 1)
+    {
+        i = -1 - int64_t(Argument(b & 0x1f));
+        return true;
+    }
+    switch (b)
+    {
+    case 0xfa:
+    {
+        uint32_t bits = uint32_t(BigEndian(4));
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        d = f;
+        return false;
+    }
+    case 0xfb:
+    {
+        uint64_t bits = BigEndian(8);
+        memcpy(&d, &bits, sizeof(d));
+        return false;
+    }
+    }
+    // Half floats and anything rarer take the slow path; null, which JSON
+    // writers send for NaN and infinities, is no number
+    --offset;
+    nlohmann::json value = Json();
+    Expect(value.is_number());
+    d = value.get<double>();
+    return false;
+}
+
+std::string PayloadReader::String()
+{
+    uint8_t b = Byte();
+    uint64_t size = 0;
+    if (format == WireFormat::MessagePack)
+    {
+        if ((b & 0xe0) == 0xa0)
+            size = b & 0x1f;
+        else if (b == 0xd9)
+            size = BigEndian(1);
+        else if (b == 0xda)
+            size = BigEndian(2);
+        else if (b == 0xdb)
+            size = BigEndian(4);
+        else
+            Expect(false);
+    }
+    else
+    {
+        Expect((b >> 5) == 3);
+        size = Argument(b & 0x1f);
+    }
+
+    Expect(size <= payload.size() - offset);
+    std::string value = payload.substr(offset, size);
+    offset += size;
+    return value;
+}
+
+nlohmann::json PayloadReader::Json()
+{
+    std::string_view rest(payload.data() + offset, payload.size() - offset);
+    nlohmann::json value = format == WireFormat::MessagePack
+        ? nlohmann::json::from_msgpack(rest, true, false)
+        : nlohmann::json::from_cbor(rest, true, false);
+    Expect(!value.is_discarded());
+    offset = payload.size();
+    return value;
+}
@@ -0,0 +1,316 @@
+#include "RpcTransport.h"
+#include "RpcCheck.h"
+#include "RpcLog.h"
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// Most buffers a single Send may gather into one write
+#define MAX_SEND_BUFFERS 16
+
+// Bytes asked for per recv
+#define RECEIVE_BUFFER_SIZE (64 * 1024)
+
+
+std::unique_ptr<ITransport> CreateTransport(TransportType type, int port)
+{
+    switch (type)
+    {
+    case TransportType::TCP:
+        return std::make_unique<TcpTransport>(port);
+#ifdef _WIN32
+    case TransportType::SharedMemory:
+    case TransportType::Unix:
+    case TransportType::UringTCP:
+    case TransportType::UringUnix:
+        throw std::runtime_error("[RPC Client] Transport is not supported on Windows.");
+#else
+    case TransportType::SharedMemory:
+        return std::make_unique<ShmTransport>(port);
+    case TransportType::Unix:
+        return std::make_unique<UnixTransport>(UnixSocketPath(port));
+    case TransportType::UringTCP:
+        if (UringTransport::Supported())
+            return std::make_unique<UringTransport>(port);
+        RPC_LOG_INFO("[RPC Client] io_uring is not available, using TCP.");
+        return std::make_unique<TcpTransport>(port);
+    case TransportType::UringUnix:
+        if (UringTransport::Supported())
+            return std::make_unique<UringTransport>(UnixSocketPath(port));
+        RPC_LOG_INFO("[RPC Client] io_uring is not available, using a Unix socket.");
+        return std::make_unique<UnixTransport>(UnixSocketPath(port));
+#endif
+    }
+    throw std::runtime_error("[RPC Client] Unknown transport type.");
+}
+
+std::string UnixSocketPath(int port)
+{
+    return "/tmp/SharedMemRPC." + std::to_string(port) + ".sock";
+}
+
+bool StreamTransport::ReceiveFrame(ResponseHeader& header, std::string& payload)
+{
+    if (!Recv(&header, sizeof(ResponseHeader)))
+        return false;
+
+    payload.resize(header.bufferSize);
+    return Recv(payload.data(), payload.size());
+}
+
+SocketTransport::SocketTransport():
+    clientSocket((SOCKET_TYPE)-1), receiveOffset(0), receiveSize(0)
+{
+#ifdef _WIN32
+    WSADATA wsaData;
+    int iResult = WSAStartup(MAKEWORD(2,2), &wsaData);
+    if (iResult != 0) {
+        throw std::runtime_error("WSAStartup failed.\n");
+    }
+#endif
+    closed.store(false);
+}
+
+SocketTransport::~SocketTransport()
+{
+    Close();
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+void ITransport::SendWithFd(const TransportBuffer*, size_t, int)
+{
+    throw std::runtime_error("[RPC Client] Transport can't pass file descriptors.");
+}
+
+void SocketTransport::Send(const TransportBuffer* buffers, size_t count)
+{
+    SendMessage(buffers, count, -1);
+}
+
+void SocketTransport::SendWithFd(const TransportBuffer* buffers, size_t count, int fd)
+{
+#ifdef _WIN32
+    ITransport::SendWithFd(buffers, count, fd);
+#else
+    SendMessage(buffers, count, fd);
+#endif
+}
+
+void SocketTransport::SendMessage(const TransportBuffer* buffers, size_t count, int fd)
+{
+    STATUS_CHECK(count > MAX_SEND_BUFFERS, "DEBUG: too many send buffers");
+
+    // Gather everything into one write and resume after partial writes
+#ifdef _WIN32
+    WSABUF pending[MAX_SEND_BUFFERS];
+    for (size_t i = 0; i < count; ++i)
+    {
+        pending[i].buf = (CHAR*)buffers[i].data;
+        pending[i].len = (ULONG)buffers[i].size;
+    }
+    #define PENDING_LEN(i) pending[i].len
+    #define PENDING_ADVANCE(i, n) (pending[i].buf += (n), pending[i].len -= (ULONG)(n))
+#else
+    iovec pending[MAX_SEND_BUFFERS];
+    for (size_t i = 0; i < count; ++i)
+    {
+        pending[i].iov_base = const_cast<void*>(buffers[i].data);
+        pending[i].iov_len = buffers[i].size;
+    }
+    #define PENDING_LEN(i) pending[i].iov_len
+    #define PENDING_ADVANCE(i, n) (pending[i].iov_base = (char*)pending[i].iov_base + (n), pending[i].iov_len -= (n))
+#endif
+
+    size_t first = 0;
+    while (first < count && PENDING_LEN(first) == 0)
+        ++first;
+
+    while (first < count)
+    {
+#ifdef _WIN32
+        DWORD bytesSent = 0;
+        int status = WSASend(clientSocket, pending + first, (DWORD)(count - first), &bytesSent, 0, NULL, NULL);
+        STATUS_CHECK(status == SOCKET_ERROR, "DEBUG: failed to send everything");
+        size_t sent = bytesSent;
+#else
+        msghdr message = {};
+        message.msg_iov = pending + first;
+        message.msg_iovlen = count - first;
+
+        // The descriptor rides along with the first byte written
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        if (fd >= 0)
+        {
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            cmsghdr* rights = CMSG_FIRSTHDR(&message);
+            rights->cmsg_level = SOL_SOCKET;
+            rights->cmsg_type = SCM_RIGHTS;
+            rights->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(rights), &fd, sizeof(int));
+        }
+
+        ssize_t bytesSent = sendmsg(clientSocket, &message, 0);
+        STATUS_CHECK(bytesSent == -1, "DEBUG: failed to send everything");
+        size_t sent = bytesSent;
+        fd = -1;
+#endif
+
+        while (first < count && sent >= PENDING_LEN(first))
+            sent -= PENDING_LEN(first++);
+        if (sent != 0)
+            PENDING_ADVANCE(first, sent);
+        while (first < count && PENDING_LEN(first) == 0)
+            ++first;
+    }
+
+    #undef PENDING_LEN
+    #undef PENDING_ADVANCE
+}
+
+bool SocketTransport::Recv(void* data, size_t size)
+{
+    char* dataPtr = static_cast<char*>(data);
+
+    // Serve from what the last recv brought in; a burst of frames costs one
+    // syscall instead of two per frame
+    size_t buffered = std::min(size, receiveSize - receiveOffset);
+    memcpy(dataPtr, receiveBuffer.data() + receiveOffset, buffered);
+    receiveOffset += buffered;
+    dataPtr += buffered;
+    size -= buffered;
+
+    // Large payloads go straight to the caller
+    if (size >= RECEIVE_BUFFER_SIZE)
+    {
+        while (size > 0)
+        {
+            int received = recv(clientSocket, dataPtr, size, MSG_WAITALL);
+            if (received <= 0)
+                return false;
+            dataPtr += received;
+            size -= received;
+        }
+        return true;
+    }
+
+    while (size > 0)
+    {
+        receiveBuffer.resize(RECEIVE_BUFFER_SIZE);
+        int received = recv(clientSocket, receiveBuffer.data(), receiveBuffer.size(), 0);
+        if (received <= 0)
+            return false;
+        receiveSize = received;
+
+        size_t chunk = std::min(size, receiveSize);
+        memcpy(dataPtr, receiveBuffer.data(), chunk);
+        receiveOffset = chunk;
+        dataPtr += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+void SocketTransport::Wakeup()
+{
+    if (closed.exchange(true))
+        return;
+
+    // Fails the receiver's pending recv without releasing the socket under it
+#ifdef _WIN32
+    shutdown(clientSocket, SD_BOTH);
+#else
+    shutdown(clientSocket, SHUT_RDWR);
+#endif
+}
+
+void SocketTransport::Close()
+{
+    if (clientSocket == (SOCKET_TYPE)-1)
+        return;
+
+    Wakeup();
+#ifdef _WIN32
+    closesocket(clientSocket);
+#else
+    close(clientSocket);
+#endif
+    clientSocket = (SOCKET_TYPE)-1;
+}
+
+bool SocketTransport::PeerClosed()
+{
+#ifdef _WIN32
+    return closed;
+#else
+    pollfd pfd = { clientSocket, POLLIN | POLLRDHUP, 0 };
+    if (poll(&pfd, 1, 0) <= 0)
+        return closed;
+    return closed || (pfd.revents & (POLLHUP | POLLRDHUP | POLLERR)) != 0;
+#endif
+}
+
+TcpTransport::TcpTransport(int port): port(port)
+{
+}
+
+void TcpTransport::Connect()
+{
+#ifdef _WIN32
+    clientSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (clientSocket == INVALID_SOCKET) {
+        throw std::runtime_error("Error at socket creation.\n");
+    }
+
+    sockaddr_in serverAddr;
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(port);
+    serverAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(clientSocket, (SOCKADDR*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
+        throw std::runtime_error("Socket connection failed.\n");
+    }
+#else
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = INADDR_ANY;
+
+    SOCKET_CHECK((clientSocket = socket(AF_INET, SOCK_STREAM, 0)));
+    SOCKET_CHECK(connect(clientSocket, (struct sockaddr*)&address, sizeof(address)));
+#endif
+
+    // Frames go out in one write; don't hold small ones back waiting for ACKs
+    int noDelay = 1;
+    setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+}
+
+#ifndef _WIN32
+UnixTransport::UnixTransport(const std::string& path): path(path)
+{
+}
+
+void UnixTransport::Connect()
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    STATUS_CHECK(path.size() >= sizeof(address.sun_path), "DEBUG: unix socket path too long");
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    SOCKET_CHECK((clientSocket = socket(AF_UNIX, SOCK_STREAM, 0)));
+    SOCKET_CHECK(connect(clientSocket, (struct sockaddr*)&address, sizeof(address)));
+}
+#endif
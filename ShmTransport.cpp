@@ -0,0 +1,149 @@
+#ifndef _WIN32
+
+#include "RpcTransport.h"
+#include "RpcProtocol.h"
+#include "RpcCheck.h"
+#include "ShmRing.h"
+#include "RpcLog.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <nlohmann/json.hpp>
+
+
+ShmTransport::ShmTransport(int port): helloPending(false), segment(nullptr), segmentSize(0)
+{
+    control = std::make_unique<TcpTransport>(port);
+    peerAlive = [this]() { return !control->PeerClosed(); };
+}
+
+ShmTransport::~ShmTransport()
+{
+    Close();
+}
+
+void ShmTransport::Connect()
+{
+    control->Connect();
+
+    // The server greets every connection over TCP; keep the greeting for
+    // the first ReceiveFrame so the client sees the same handshake as TCP.
+    std::string helloArgs;
+    STATUS_CHECK(!control->ReceiveFrame(hello, helloArgs), "DEBUG: Error receiving client ID.");
+    helloPending = true;
+
+    if (!Attach())
+        RPC_LOG_INFO("[RPC Client] Server does not support shared memory, using TCP.");
+}
+
+bool ShmTransport::Attach()
+{
+    static std::atomic_int segmentCount{0};
+    segmentName = "/SharedMemRPC." + std::to_string(getpid()) + "." + std::to_string(segmentCount++);
+    segmentSize = ShmSegmentSize(SHM_RING_CAPACITY);
+
+    int fd = shm_open(segmentName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    SOCKET_CHECK(fd);
+    STATUS_CHECK(ftruncate(fd, segmentSize) != 0, "DEBUG: failed to size shared memory");
+    void* mapping = mmap(nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    STATUS_CHECK(mapping == MAP_FAILED, "DEBUG: failed to map shared memory");
+
+    segment = static_cast<ShmSegment*>(mapping);
+    ShmInitSegment(segment, SHM_RING_CAPACITY);
+    requestRing = std::make_unique<ShmRingView>(ShmRequestView(segment, SHM_RING_CAPACITY));
+    responseRing = std::make_unique<ShmRingView>(ShmResponseView(segment, SHM_RING_CAPACITY));
+
+    nlohmann::json args;
+    args["keys"] = { "name", "capacity" };
+    args["values"] = { nlohmann::json(segmentName).dump(), std::to_string(SHM_RING_CAPACITY) };
+
+    RpcRequest rpcRequest{};
+    rpcRequest.header.clientId = hello.clientId;
+    strncpy(
+        rpcRequest.header.functionName,
+        "_RPC::AttachSharedMemory",
+        sizeof(rpcRequest.header.functionName) - 1
+    );
+    rpcRequest.jsonArgs = args.dump();
+    rpcRequest.header.bufferSize = rpcRequest.jsonArgs.size();
+
+    TransportBuffer buffers[] = {
+        { &rpcRequest.header, sizeof(rpcRequest.header) },
+        { rpcRequest.jsonArgs.data(), rpcRequest.jsonArgs.size() }
+    };
+    control->Send(buffers, 2);
+
+    ResponseHeader responseHeader;
+    std::string responseArgsJson;
+    STATUS_CHECK(!control->ReceiveFrame(responseHeader, responseArgsJson), "DEBUG: failed to recv attach reply");
+
+    // Either the server has mapped the segment by now or it never will
+    shm_unlink(segmentName.c_str());
+
+    if (responseHeader.u.statusCode != 0)
+    {
+        munmap(segment, segmentSize);
+        segment = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void ShmTransport::Send(const TransportBuffer* buffers, size_t count)
+{
+    if (!segment)
+        return control->Send(buffers, count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        bool sent = ShmRingWrite(*requestRing, buffers[i].data, buffers[i].size, peerAlive);
+        STATUS_CHECK(!sent, "DEBUG: failed to send everything");
+    }
+}
+
+bool ShmTransport::ReceiveFrame(ResponseHeader& header, std::string& payload)
+{
+    if (helloPending)
+    {
+        helloPending = false;
+        header = hello;
+        payload.clear();
+        return true;
+    }
+
+    if (!segment)
+        return control->ReceiveFrame(header, payload);
+    return StreamTransport::ReceiveFrame(header, payload);
+}
+
+bool ShmTransport::Recv(void* data, size_t size)
+{
+    return ShmRingRead(*responseRing, data, size, peerAlive);
+}
+
+void ShmTransport::Wakeup()
+{
+    if (segment)
+    {
+        ShmRingClose(segment->requestRing);
+        ShmRingClose(segment->responseRing);
+    }
+    control->Wakeup();
+}
+
+void ShmTransport::Close()
+{
+    Wakeup();
+    if (segment)
+    {
+        munmap(segment, segmentSize);
+        segment = nullptr;
+    }
+    control->Close();
+}
+
+#endif
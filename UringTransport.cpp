@@ -0,0 +1,625 @@
+#ifndef _WIN32
+
+#include "RpcTransport.h"
+#include "RpcCheck.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#if __has_include(<linux/io_uring.h>)
+#define RPC_HAS_IO_URING 1
+
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Submission queue size; at most a send and the receive are ever queued
+#define URING_ENTRIES 8
+
+// Buffers the kernel picks from for received data; a power of two
+#define RECV_BUFFER_COUNT 16
+#define RECV_BUFFER_SIZE (64 * 1024)
+#define RECV_BUFFER_GROUP 0
+
+// Frames up to this size are copied and may share a send with others;
+// larger ones are sent from the caller's buffers
+#define SEND_COPY_LIMIT (64 * 1024)
+
+// Senders wait once this much is staged behind the send in flight
+#define SEND_STAGE_LIMIT (1024 * 1024)
+
+#define RECV_TAG 1
+#define SEND_TAG 2
+
+
+struct UringState
+{
+    int socketFd = -1;
+    int ringFd = -1;
+    std::atomic_bool closed{false};
+
+    // Rings shared with the kernel
+    void* sqMap = MAP_FAILED;
+    size_t sqMapSize = 0;
+    void* cqMap = MAP_FAILED;
+    size_t cqMapSize = 0;
+    io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+    size_t sqesSize = 0;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    io_uring_cqe* cqes;
+
+    io_uring_buf_ring* bufferRing = (io_uring_buf_ring*)MAP_FAILED;
+    char* buffers = (char*)MAP_FAILED;
+    uint16_t bufferTail = 0;
+
+    // Submissions and the send side. Holders never block on cqMutex.
+    std::mutex sqMutex;
+    std::condition_variable sendProgress;
+    std::string staging;            // Frames waiting for the send in flight
+    std::string sending;            // Copied bytes of the send in flight
+    std::vector<iovec> sendIov;
+    size_t sendFirst = 0;
+    msghdr sendMessage{};
+    bool sendBusy = false;
+    bool sendFailed = false;
+    uint64_t sendsStarted = 0;
+    uint64_t sendsFinished = 0;
+
+    // Completions and received bytes; taken by whoever waits on the ring
+    std::mutex cqMutex;
+    std::string received;
+    size_t receivedOffset = 0;
+    bool receiveArmed = false;
+    bool receiveEnded = false;
+
+    bool Setup();
+    void Teardown();
+
+    void Push(const io_uring_sqe& sqe);
+    void ArmReceive();
+    void StartSend();
+    void SubmitSend();
+    void ProvideBuffer(uint16_t id);
+
+    void WaitForCompletion();
+    void Reap();
+    void OnReceive(const io_uring_cqe& cqe);
+    void OnSend(const io_uring_cqe& cqe);
+
+    template <typename Predicate>
+    void WaitForSend(std::unique_lock<std::mutex>& sqLock, Predicate done);
+};
+
+static int UringSetup(unsigned entries, io_uring_params* params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int UringEnter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+static int UringRegister(int ringFd, unsigned opcode, void* arg, unsigned count)
+{
+    return (int)syscall(__NR_io_uring_register, ringFd, opcode, arg, count);
+}
+
+bool UringState::Setup()
+{
+    io_uring_params params{};
+    ringFd = UringSetup(URING_ENTRIES, &params);
+    if (ringFd < 0)
+        return false;
+
+    sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMap)
+        sqMapSize = cqMapSize = std::max(sqMapSize, cqMapSize);
+
+    sqMap = mmap(nullptr, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqMap == MAP_FAILED)
+        return false;
+    cqMap = singleMap ? sqMap : mmap(nullptr, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    if (cqMap == MAP_FAILED)
+        return false;
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe*)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        return false;
+
+    char* sq = (char*)sqMap;
+    sqTail = (unsigned*)(sq + params.sq_off.tail);
+    sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    sqArray = (unsigned*)(sq + params.sq_off.array);
+
+    char* cq = (char*)cqMap;
+    cqHead = (unsigned*)(cq + params.cq_off.head);
+    cqTail = (unsigned*)(cq + params.cq_off.tail);
+    cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // The buffer ring must be page aligned; fresh mappings are
+    bufferRing = (io_uring_buf_ring*)mmap(nullptr, RECV_BUFFER_COUNT * sizeof(io_uring_buf),
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    buffers = (char*)mmap(nullptr, RECV_BUFFER_COUNT * RECV_BUFFER_SIZE,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufferRing == MAP_FAILED || buffers == MAP_FAILED)
+        return false;
+
+    io_uring_buf_reg registration{};
+    registration.ring_addr = (uint64_t)bufferRing;
+    registration.ring_entries = RECV_BUFFER_COUNT;
+    registration.bgid = RECV_BUFFER_GROUP;
+    if (UringRegister(ringFd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
+        return false;
+
+    for (uint16_t id = 0; id < RECV_BUFFER_COUNT; ++id)
+        ProvideBuffer(id);
+    return true;
+}
+
+void UringState::Teardown()
+{
+    // Closing the ring cancels anything still queued, so it goes before
+    // the memory the kernel writes into
+    if (ringFd >= 0)
+        close(ringFd);
+    if (sqes != MAP_FAILED)
+        munmap(sqes, sqesSize);
+    if (cqMap != MAP_FAILED && cqMap != sqMap)
+        munmap(cqMap, cqMapSize);
+    if (sqMap != MAP_FAILED)
+        munmap(sqMap, sqMapSize);
+    if (bufferRing != MAP_FAILED)
+        munmap(bufferRing, RECV_BUFFER_COUNT * sizeof(io_uring_buf));
+    if (buffers != MAP_FAILED)
+        munmap(buffers, RECV_BUFFER_COUNT * RECV_BUFFER_SIZE);
+    if (socketFd >= 0)
+        close(socketFd);
+
+    ringFd = socketFd = -1;
+    sqMap = cqMap = MAP_FAILED;
+    sqes = (io_uring_sqe*)MAP_FAILED;
+    bufferRing = (io_uring_buf_ring*)MAP_FAILED;
+    buffers = (char*)MAP_FAILED;
+}
+
+void UringState::ProvideBuffer(uint16_t id)
+{
+    // Indexed by hand: in C++ the header's flexible array sits 8 bytes
+    // past where the kernel reads it
+    io_uring_buf& buffer = ((io_uring_buf*)bufferRing)[bufferTail & (RECV_BUFFER_COUNT - 1)];
+    buffer.addr = (uint64_t)(buffers + size_t(id) * RECV_BUFFER_SIZE);
+    buffer.len = RECV_BUFFER_SIZE;
+    buffer.bid = id;
+    __atomic_store_n(&bufferRing->tail, ++bufferTail, __ATOMIC_RELEASE);
+}
+
+void UringState::Push(const io_uring_sqe& sqe)
+{
+    // Every entry is submitted right away, so the queue never fills
+    unsigned tail = *sqTail;
+    unsigned index = tail & *sqMask;
+    sqes[index] = sqe;
+    sqArray[index] = index;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    int submitted;
+    do
+        submitted = UringEnter(ringFd, 1, 0, 0);
+    while (submitted < 0 && errno == EINTR);
+    STATUS_CHECK(submitted < 0, "DEBUG: io_uring submission failed");
+}
+
+void UringState::ArmReceive()
+{
+    // Completes once per chunk received, each in a buffer the kernel picks
+    io_uring_sqe sqe{};
+    sqe.opcode = IORING_OP_RECV;
+    sqe.fd = socketFd;
+    sqe.ioprio = IORING_RECV_MULTISHOT;
+    sqe.flags = IOSQE_BUFFER_SELECT;
+    sqe.buf_group = RECV_BUFFER_GROUP;
+    sqe.user_data = RECV_TAG;
+    receiveArmed = true;
+    Push(sqe);
+}
+
+void UringState::StartSend()
+{
+    // Everything staged so far goes out as one send
+    sending.swap(staging);
+    staging.clear();
+    sendIov.assign(1, iovec{ sending.data(), sending.size() });
+    sendFirst = 0;
+    sendBusy = true;
+    ++sendsStarted;
+    SubmitSend();
+}
+
+void UringState::SubmitSend()
+{
+    sendMessage = msghdr{};
+    sendMessage.msg_iov = sendIov.data() + sendFirst;
+    sendMessage.msg_iovlen = sendIov.size() - sendFirst;
+
+    io_uring_sqe sqe{};
+    sqe.opcode = IORING_OP_SENDMSG;
+    sqe.fd = socketFd;
+    sqe.addr = (uint64_t)&sendMessage;
+    sqe.msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe.user_data = SEND_TAG;
+    Push(sqe);
+}
+
+void UringState::WaitForCompletion()
+{
+    int status = UringEnter(ringFd, 0, 1, IORING_ENTER_GETEVENTS);
+    STATUS_CHECK(status < 0 && errno != EINTR, "DEBUG: io_uring wait failed");
+}
+
+void UringState::Reap()
+{
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head)
+    {
+        const io_uring_cqe& cqe = cqes[head & *cqMask];
+        if (cqe.user_data == RECV_TAG)
+            OnReceive(cqe);
+        else if (cqe.user_data == SEND_TAG)
+            OnSend(cqe);
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+}
+
+void UringState::OnReceive(const io_uring_cqe& cqe)
+{
+    if (cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER))
+    {
+        // Copied out so the buffer goes straight back to the kernel
+        uint16_t id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        if (receivedOffset == received.size())
+        {
+            received.clear();
+            receivedOffset = 0;
+        }
+        received.append(buffers + size_t(id) * RECV_BUFFER_SIZE, cqe.res);
+        ProvideBuffer(id);
+    }
+
+    if (cqe.flags & IORING_CQE_F_MORE)
+        return;
+
+    // The kernel ends a multishot receive when it runs out of buffers;
+    // anything else ending it is a disconnect or Wakeup
+    receiveArmed = false;
+    if ((cqe.res > 0 || cqe.res == -ENOBUFS) && !closed)
+    {
+        std::lock_guard<std::mutex> sqLock(sqMutex);
+        ArmReceive();
+    }
+    else
+    {
+        receiveEnded = true;
+    }
+}
+
+void UringState::OnSend(const io_uring_cqe& cqe)
+{
+    std::lock_guard<std::mutex> sqLock(sqMutex);
+    if (cqe.res < 0)
+    {
+        sendFailed = true;
+        sendBusy = false;
+        ++sendsFinished;
+        sendProgress.notify_all();
+        return;
+    }
+
+    size_t sent = cqe.res;
+    while (sendFirst < sendIov.size() && sent >= sendIov[sendFirst].iov_len)
+        sent -= sendIov[sendFirst++].iov_len;
+    if (sent != 0)
+    {
+        sendIov[sendFirst].iov_base = (char*)sendIov[sendFirst].iov_base + sent;
+        sendIov[sendFirst].iov_len -= sent;
+    }
+
+    if (sendFirst < sendIov.size())
+    {
+        SubmitSend();
+        return;
+    }
+
+    ++sendsFinished;
+    if (!staging.empty())
+        StartSend();
+    else
+        sendBusy = false;
+    sendProgress.notify_all();
+}
+
+template <typename Predicate>
+void UringState::WaitForSend(std::unique_lock<std::mutex>& sqLock, Predicate done)
+{
+    // Usually the receiver thread is waiting on the ring and reaps the send
+    // for us; otherwise wait on the ring here. Waiting on sqMutex's condition
+    // is bounded in case the receiver stopped reaping.
+    while (!done())
+    {
+        if (cqMutex.try_lock())
+        {
+            sqLock.unlock();
+            WaitForCompletion();
+            Reap();
+            cqMutex.unlock();
+            sqLock.lock();
+        }
+        else
+        {
+            sendProgress.wait_for(sqLock, std::chrono::milliseconds(10));
+        }
+    }
+}
+
+
+UringTransport::UringTransport(int port): port(port), state(std::make_unique<UringState>())
+{
+}
+
+UringTransport::UringTransport(const std::string& path): port(0), path(path), state(std::make_unique<UringState>())
+{
+}
+
+UringTransport::~UringTransport()
+{
+    Close();
+}
+
+bool UringTransport::Supported()
+{
+    static const bool supported = []()
+    {
+        // Buffer rings arrived in 5.19 but multishot receive only in 6.0,
+        // so arm one on a socket pair with data waiting. Older kernels
+        // fail it or complete it once without IORING_CQE_F_MORE.
+        UringState probe;
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0)
+            return false;
+        probe.socketFd = pair[0];
+
+        bool usable = false;
+        char byte = 0;
+        if (probe.Setup() && write(pair[1], &byte, 1) == 1)
+        {
+            // Queued by hand: Push gives up on the process if entering fails
+            io_uring_sqe& sqe = probe.sqes[0];
+            sqe = io_uring_sqe{};
+            sqe.opcode = IORING_OP_RECV;
+            sqe.fd = probe.socketFd;
+            sqe.ioprio = IORING_RECV_MULTISHOT;
+            sqe.flags = IOSQE_BUFFER_SELECT;
+            sqe.buf_group = RECV_BUFFER_GROUP;
+            sqe.user_data = RECV_TAG;
+            probe.sqArray[*probe.sqTail & *probe.sqMask] = 0;
+            __atomic_store_n(probe.sqTail, *probe.sqTail + 1, __ATOMIC_RELEASE);
+
+            int status;
+            do
+                status = UringEnter(probe.ringFd, 1, 1, IORING_ENTER_GETEVENTS);
+            while (status < 0 && errno == EINTR);
+
+            unsigned head = *probe.cqHead;
+            if (status >= 0 && head != __atomic_load_n(probe.cqTail, __ATOMIC_ACQUIRE))
+            {
+                const io_uring_cqe& cqe = probe.cqes[head & *probe.cqMask];
+                usable = cqe.res == 1 && (cqe.flags & IORING_CQE_F_MORE);
+            }
+        }
+
+        probe.Teardown();
+        close(pair[1]);
+        return usable;
+    }();
+    return supported;
+}
+
+void UringTransport::Connect()
+{
+    if (path.empty())
+    {
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = INADDR_ANY;
+
+        SOCKET_CHECK((state->socketFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)));
+        SOCKET_CHECK(connect(state->socketFd, (struct sockaddr*)&address, sizeof(address)));
+
+        int noDelay = 1;
+        setsockopt(state->socketFd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    }
+    else
+    {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        STATUS_CHECK(path.size() >= sizeof(address.sun_path), "DEBUG: unix socket path too long");
+        strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+        SOCKET_CHECK((state->socketFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)));
+        SOCKET_CHECK(connect(state->socketFd, (struct sockaddr*)&address, sizeof(address)));
+    }
+
+    STATUS_CHECK(!state->Setup(), "DEBUG: io_uring setup failed");
+
+    std::lock_guard<std::mutex> sqLock(state->sqMutex);
+    state->ArmReceive();
+}
+
+void UringTransport::Send(const TransportBuffer* buffers, size_t count)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i)
+        total += buffers[i].size;
+
+    std::unique_lock<std::mutex> sqLock(state->sqMutex);
+    if (total <= SEND_COPY_LIMIT)
+    {
+        state->WaitForSend(sqLock, [&]() { return state->sendFailed || state->staging.size() < SEND_STAGE_LIMIT; });
+        STATUS_CHECK(state->sendFailed, "DEBUG: failed to send everything");
+
+        for (size_t i = 0; i < count; ++i)
+            state->staging.append((const char*)buffers[i].data, buffers[i].size);
+        if (!state->sendBusy)
+            state->StartSend();
+        return;
+    }
+
+    // Large frames skip the copy, so they wait for the ring to be free and
+    // for their own send to finish before the caller's buffers go away
+    state->WaitForSend(sqLock, [&]() { return state->sendFailed || !state->sendBusy; });
+    STATUS_CHECK(state->sendFailed, "DEBUG: failed to send everything");
+
+    state->sendIov.clear();
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (buffers[i].size != 0)
+            state->sendIov.push_back(iovec{ const_cast<void*>(buffers[i].data), buffers[i].size });
+    }
+    state->sendFirst = 0;
+    state->sendBusy = true;
+    uint64_t ticket = ++state->sendsStarted;
+    state->SubmitSend();
+
+    state->WaitForSend(sqLock, [&]() { return state->sendsFinished >= ticket; });
+    STATUS_CHECK(state->sendFailed, "DEBUG: failed to send everything");
+}
+
+bool UringTransport::Recv(void* data, size_t size)
+{
+    char* dataPtr = static_cast<char*>(data);
+
+    std::lock_guard<std::mutex> cqLock(state->cqMutex);
+    while (size > 0)
+    {
+        size_t available = state->received.size() - state->receivedOffset;
+        if (available > 0)
+        {
+            size_t chunk = std::min(size, available);
+            memcpy(dataPtr, state->received.data() + state->receivedOffset, chunk);
+            state->receivedOffset += chunk;
+            dataPtr += chunk;
+            size -= chunk;
+            continue;
+        }
+
+        if (state->receiveEnded || state->closed)
+            return false;
+        state->WaitForCompletion();
+        state->Reap();
+    }
+    return true;
+}
+
+void UringTransport::Wakeup()
+{
+    if (state->closed.exchange(true) || state->socketFd < 0)
+        return;
+
+    // Ends the multishot receive, which fails the receiver's pending Recv
+    shutdown(state->socketFd, SHUT_RDWR);
+}
+
+void UringTransport::Close()
+{
+    if (state->socketFd < 0)
+        return;
+
+    Wakeup();
+
+    // Let the kernel finish with our buffers before they are unmapped
+    if (state->ringFd >= 0)
+    {
+        auto sendBusy = [&]()
+        {
+            std::lock_guard<std::mutex> sqLock(state->sqMutex);
+            return state->sendBusy;
+        };
+
+        std::lock_guard<std::mutex> cqLock(state->cqMutex);
+        while (state->receiveArmed || sendBusy())
+        {
+            state->WaitForCompletion();
+            state->Reap();
+        }
+    }
+    state->Teardown();
+}
+
+#else
+
+struct UringState
+{
+};
+
+UringTransport::UringTransport(int port): port(port)
+{
+}
+
+UringTransport::UringTransport(const std::string& path): port(0), path(path)
+{
+}
+
+UringTransport::~UringTransport()
+{
+}
+
+bool UringTransport::Supported()
+{
+    return false;
+}
+
+void UringTransport::Connect()
+{
+    throw std::runtime_error("[RPC Client] io_uring is not available in this build.");
+}
+
+void UringTransport::Send(const TransportBuffer*, size_t)
+{
+}
+
+bool UringTransport::Recv(void*, size_t)
+{
+    return false;
+}
+
+void UringTransport::Wakeup()
+{
+}
+
+void UringTransport::Close()
+{
+}
+
+#endif
+
+#endif
@@ -0,0 +1,470 @@
+#include "RpcClient.h"
+#include "RpcLog.h"
+#include "RpcStats.h"
+#ifndef _WIN32
+#include "RpcServer.h"
+
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Round-trip benchmarks for the client library. Calls go to a stand-in
+// server answering on the other end of a LoopbackTransport, so the numbers
+// cover the client's encode, send, receive and wake-up paths without a
+// network or a real server in the way. The transports suite compares the
+// real transports against a native RpcServer in a child process instead.
+//
+//   rpcBench [--quick] [payload] [concurrency] [fanin] [transports]
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    constexpr int CLIENT_ID = 1;
+
+    // Speaks just enough of the protocol for the benchmarks: a JSON
+    // _RPC::Negotiate, then compact headers and MessagePack. Functions:
+    //   echo(data)                  returns data
+    //   fanout(count, size, cb)     calls cb count times with size bytes, returns count
+    class StandInServer
+    {
+    public:
+        StandInServer(std::shared_ptr<LoopbackPipe> requests, std::shared_ptr<LoopbackPipe> responses):
+            requests(std::move(requests)), responses(std::move(responses)), compact(false)
+        {
+        }
+
+        // Runs until the client closes the pipes
+        void Run()
+        {
+            ResponseHeader hello{};
+            hello.clientId = CLIENT_ID;
+            responses->Write(&hello, sizeof(hello));
+
+            std::string name;
+            std::string payload;
+            while (true)
+            {
+                int requestId;
+                uint8_t flags;
+                uint16_t resolvedId = 0;
+                int bufferSize;
+
+                if (compact)
+                {
+                    CompactRequestHeader header;
+                    if (!requests->Read(&header, sizeof(header)))
+                        return;
+
+                    requestId = header.requestId;
+                    flags = header.flags;
+                    bufferSize = header.bufferSize;
+                    if (header.methodId == 0)
+                    {
+                        name.resize(header.nameLength);
+                        if (!requests->Read(name.data(), name.size()))
+                            return;
+                        resolvedId = Resolve(name);
+                    }
+                    else
+                    {
+                        name = methods[header.methodId];
+                    }
+                }
+                else
+                {
+                    decltype(RpcRequest::header) header;
+                    if (!requests->Read(&header, sizeof(header)))
+                        return;
+
+                    requestId = header.requestId;
+                    flags = header.flags;
+                    bufferSize = header.bufferSize;
+                    name = header.functionName;
+                }
+
+                payload.resize(bufferSize);
+                if (!requests->Read(payload.data(), payload.size()))
+                    return;
+
+                WireFormat format = GetWireFormat(flags);
+                int status = 0;
+                nlohmann::json result = Dispatch(name, format, payload, status);
+                if (flags & RPC_FLAG_ONEWAY)
+                    continue;
+
+                std::string response = format == WireFormat::JSON
+                    ? nlohmann::json{{"result", result.is_string() ? result.get<std::string>() : result.dump()}}.dump()
+                    : EncodePayload(format, {{"result", std::move(result)}});
+
+                ResponseHeader header{};
+                header.clientId = CLIENT_ID;
+                header.requestId = requestId;
+                header.msgType = ResponseHeader::MsgType::MSG_RETURN;
+                header.flags = uint8_t(format);
+                header.methodId = resolvedId;
+                header.u.statusCode = status;
+                header.bufferSize = int(response.size());
+                Write(header, response);
+
+                if (name == "_RPC::Negotiate")
+                    compact = true;
+            }
+        }
+
+    private:
+        uint16_t Resolve(const std::string& function)
+        {
+            auto [it, added] = methodIds.emplace(function, uint16_t(methods.size()));
+            if (added)
+                methods.push_back(function);
+            return it->second;
+        }
+
+        nlohmann::json Dispatch(const std::string& function, WireFormat format, const std::string& payload, int& status)
+        {
+            if (function == "_RPC::Negotiate")
+                return {{ "format", WireFormatName(WireFormat::MessagePack) }, { "features", { RPC_FEATURE_COMPACT_HEADERS } }};
+
+            nlohmann::json document = DecodePayload(format, payload);
+            if (format == WireFormat::JSON || !document.is_object() || !document.contains("args"))
+            {
+                status = 1;
+                return "Stand-in server only reads MessagePack arguments";
+            }
+
+            nlohmann::json& args = document["args"];
+            if (function == "echo")
+                return std::move(args["data"]);
+
+            if (function == "fanout")
+            {
+                int count = args.value("count", 0);
+                std::vector<uint8_t> data(args.value("size", 0));
+                std::string callbackArgs = EncodePayload(format, {{"data", nlohmann::json::binary(std::move(data))}});
+
+                ResponseHeader header{};
+                header.clientId = CLIENT_ID;
+                header.msgType = ResponseHeader::MsgType::MSG_CALLBACK;
+                header.flags = uint8_t(format);
+                header.u.callbackId = int(args.value("callback", int64_t(0)));
+                header.bufferSize = int(callbackArgs.size());
+                for (int i = 0; i < count; ++i)
+                    Write(header, callbackArgs);
+                return count;
+            }
+
+            status = 1;
+            return "Unknown function " + function;
+        }
+
+        void Write(const ResponseHeader& header, const std::string& payload)
+        {
+            responses->Write(&header, sizeof(header));
+            responses->Write(payload.data(), payload.size());
+        }
+
+        std::shared_ptr<LoopbackPipe> requests;
+        std::shared_ptr<LoopbackPipe> responses;
+        bool compact;
+        std::vector<std::string> methods{ "" };
+        std::unordered_map<std::string, uint16_t> methodIds;
+    };
+
+    RpcClient& Connect()
+    {
+        return RpcClient::Get([]()
+        {
+            auto transport = std::make_unique<LoopbackTransport>();
+            std::thread([requests = transport->ToServer(), responses = transport->ToClient()]()
+            {
+                StandInServer(requests, responses).Run();
+            }).detach();
+            return transport;
+        });
+    }
+
+    double Seconds(Clock::duration duration)
+    {
+        return std::chrono::duration<double>(duration).count();
+    }
+
+    const char* SizeName(size_t bytes, char* buffer, size_t size)
+    {
+        if (bytes >= (1 << 20))
+            snprintf(buffer, size, "%zuM", bytes >> 20);
+        else if (bytes >= (1 << 10))
+            snprintf(buffer, size, "%zuK", bytes >> 10);
+        else
+            snprintf(buffer, size, "%zu", bytes);
+        return buffer;
+    }
+
+    void PrintHeader(const char* title, const char* label)
+    {
+        printf("\n%s\n", title);
+        printf("%-14s %8s %10s %10s %10s %10s %12s %10s\n",
+            label, "count", "p50 us", "p99 us", "p999 us", "max us", "ops/s", "MB/s");
+    }
+
+    void PrintRow(const char* label, const LatencyHistogram& latency, uint64_t operations, double seconds, uint64_t bytes)
+    {
+        printf("%-14s %8llu %10.1f %10.1f %10.1f %10.1f %12.0f %10.1f\n",
+            label,
+            (unsigned long long)latency.Count(),
+            latency.Percentile(50) / 1e3,
+            latency.Percentile(99) / 1e3,
+            latency.Percentile(99.9) / 1e3,
+            latency.Max() / 1e3,
+            operations / seconds,
+            bytes / seconds / (1 << 20));
+    }
+
+    nlohmann::json Payload(size_t size)
+    {
+        return nlohmann::json::binary(std::vector<uint8_t>(size, 0x5a));
+    }
+
+    // One row of echo calls with size-byte payloads
+    void EchoRow(RpcClient& client, size_t size, int scale, const char* label)
+    {
+        std::vector<std::pair<std::string, nlohmann::json>> args = { { "data", Payload(size) } };
+        int iterations = int(std::clamp<size_t>((size_t(256) << 20) / (size + 4096), 20, 20000) / scale);
+        iterations = std::max(iterations, 5);
+
+        for (int i = 0; i < std::min(iterations, 100); ++i)
+            client.Call("echo", args);
+
+        LatencyHistogram latency;
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < iterations; ++i)
+        {
+            Clock::time_point sent = Clock::now();
+            client.Call("echo", args);
+            latency.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - sent).count());
+        }
+        double seconds = Seconds(Clock::now() - start);
+        PrintRow(label, latency, iterations, seconds, 2 * uint64_t(size) * iterations);
+    }
+
+    // Latency and throughput of echo calls, from empty to 16 MB payloads
+    void BenchPayload(int scale)
+    {
+        PrintHeader("Echo round trip by payload size", "payload");
+
+        RpcClient& client = Connect();
+        for (size_t size : { size_t(0), size_t(64), size_t(1) << 10, size_t(16) << 10, size_t(256) << 10,
+            size_t(1) << 20, size_t(4) << 20, size_t(16) << 20 })
+        {
+            char label[16];
+            EchoRow(client, size, scale, SizeName(size, label, sizeof(label)));
+        }
+    }
+
+#ifndef _WIN32
+    constexpr int TRANSPORT_BENCH_PORT = 6979;
+
+    // Echo over each real transport to a native server. RpcClient is one
+    // per process, so each transport runs in a child of its own; the
+    // server runs in another. Forks happen before this process starts any
+    // threads of its own, so run this suite first.
+    void BenchTransports(int scale)
+    {
+        PrintHeader("Echo round trip by transport, native server", "transport");
+        fflush(stdout);
+
+        int ready[2];
+        if (pipe(ready) != 0)
+            return;
+
+        pid_t server = fork();
+        if (server == 0)
+        {
+            close(ready[0]);
+            RpcServer host(TRANSPORT_BENCH_PORT, 0, 1);
+            host.Register("echo", [](const nlohmann::json& args) { return args.at("data"); });
+            host.Start();
+            (void)!write(ready[1], "", 1);
+            host.Wait();
+            _exit(0);
+        }
+        close(ready[1]);
+        char started;
+        bool serverUp = server > 0 && read(ready[0], &started, 1) == 1;
+        close(ready[0]);
+        if (!serverUp)
+        {
+            fprintf(stderr, "Native server didn't start\n");
+            return;
+        }
+
+        const std::pair<const char*, TransportType> transports[] = {
+            { "tcp", TransportType::TCP },
+            { "unix", TransportType::Unix },
+            { "shm", TransportType::SharedMemory },
+            { "uring-tcp", TransportType::UringTCP },
+            { "uring-unix", TransportType::UringUnix }
+        };
+        for (const auto& [name, type] : transports)
+        {
+            pid_t client = fork();
+            if (client == 0)
+            {
+                RpcClient& rpc = RpcClient::Get(TRANSPORT_BENCH_PORT, false, type);
+                for (size_t size : { size_t(64), size_t(16) << 10, size_t(1) << 20 })
+                {
+                    char sizeName[16];
+                    char label[32];
+                    snprintf(label, sizeof(label), "%s/%s", name, SizeName(size, sizeName, sizeof(sizeName)));
+                    EchoRow(rpc, size, scale, label);
+                }
+                fflush(stdout);
+                _exit(0);
+            }
+            if (client > 0)
+                waitpid(client, nullptr, 0);
+        }
+
+        kill(server, SIGTERM);
+        waitpid(server, nullptr, 0);
+    }
+#endif
+
+    // Small calls from many threads at once, sharing one connection
+    void BenchConcurrency(int scale)
+    {
+        PrintHeader("64-byte echo by concurrent callers", "callers");
+
+        RpcClient& client = Connect();
+        std::vector<std::pair<std::string, nlohmann::json>> args = { { "data", Payload(64) } };
+        int iterations = std::max(20000 / scale, 100);
+
+        for (int callers : { 1, 2, 4, 8, 16 })
+        {
+            std::vector<LatencyHistogram> latencies(callers);
+            std::vector<std::thread> threads;
+            Clock::time_point start = Clock::now();
+            for (int t = 0; t < callers; ++t)
+            {
+                threads.emplace_back([&, t]()
+                {
+                    for (int i = 0; i < iterations / callers; ++i)
+                    {
+                        Clock::time_point sent = Clock::now();
+                        client.Call("echo", args);
+                        latencies[t].Record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - sent).count());
+                    }
+                });
+            }
+            for (std::thread& thread : threads)
+                thread.join();
+            double seconds = Seconds(Clock::now() - start);
+
+            LatencyHistogram latency;
+            for (const LatencyHistogram& part : latencies)
+                latency.Merge(part);
+
+            char label[16];
+            snprintf(label, sizeof(label), "%d", callers);
+            PrintRow(label, latency, latency.Count(), seconds, 2 * 64 * latency.Count());
+        }
+    }
+
+    // Callbacks the server fires per call; latency is from the call to the
+    // last callback, ops are callbacks delivered
+    void BenchFanIn(int scale)
+    {
+        PrintHeader("Callback fan-in, 64-byte callbacks", "per call");
+
+        RpcClient& client = Connect();
+        for (int count : { 1, 16, 256, 4096 })
+        {
+            std::atomic_int received{0};
+            std::vector<std::pair<std::string, RpcClient::Callback>> callbacks = {
+                { "callback", [&](const nlohmann::json&)
+                    {
+                        if (received.fetch_add(1) + 1 == count)
+                            received.notify_one();
+                    }
+                }
+            };
+
+            int rounds = std::max(std::max(40000 / count, 20) / scale, 5);
+            LatencyHistogram latency;
+            Clock::time_point start = Clock::now();
+            for (int i = 0; i < rounds; ++i)
+            {
+                received.store(0);
+                Clock::time_point sent = Clock::now();
+                client.Call("fanout", {{"count", count}, {"size", 64}}, callbacks);
+
+                int seen;
+                while ((seen = received.load()) < count)
+                    received.wait(seen);
+                latency.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - sent).count());
+            }
+            double seconds = Seconds(Clock::now() - start);
+
+            char label[16];
+            snprintf(label, sizeof(label), "%d", count);
+            PrintRow(label, latency, uint64_t(count) * rounds, seconds, uint64_t(64) * count * rounds);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int scale = 1;
+    std::vector<std::string> suites;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--quick") == 0)
+            scale = 10;
+        else
+            suites.push_back(argv[i]);
+    }
+    if (suites.empty())
+        suites = { "payload", "concurrency", "fanin" };
+
+    RpcLog::SetLevel(LogLevel::Warning);
+
+    // Forks, so it goes before anything starts a thread
+    auto transports = std::find(suites.begin(), suites.end(), "transports");
+    if (transports != suites.end())
+    {
+        suites.erase(transports);
+#ifndef _WIN32
+        BenchTransports(scale);
+#else
+        fprintf(stderr, "The transports suite needs Linux\n");
+#endif
+    }
+
+    for (const std::string& suite : suites)
+    {
+        if (suite == "payload")
+            BenchPayload(scale);
+        else if (suite == "concurrency")
+            BenchConcurrency(scale);
+        else if (suite == "fanin")
+            BenchFanIn(scale);
+        else
+        {
+            fprintf(stderr, "Unknown suite %s; expected payload, concurrency, fanin or transports\n", suite.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include "RpcServer.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <unordered_map>
+
+// Native stand-in for server/Program.cs, serving the same functions so
+// rpcMain and rpcBench-style clients run against a plain Linux build.
+//
+//   rpcHost [port] [workerThreads] [eventLoops]
+
+namespace
+{
+    struct Timer
+    {
+        std::atomic_bool stopped{false};
+        std::atomic_bool finished{false};   // Its client went away
+        std::thread thread;
+    };
+
+    std::mutex timerMutex;
+    std::unordered_map<int, std::unique_ptr<Timer>> timers;
+    int nextTimerHandle = 1;
+
+    // Joins timers that stopped on their own; call with timerMutex held
+    void ReapTimers()
+    {
+        for (auto it = timers.begin(); it != timers.end();)
+        {
+            if (!it->second->finished)
+            {
+                ++it;
+                continue;
+            }
+            it->second->thread.join();
+            it = timers.erase(it);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int port = argc > 1 ? atoi(argv[1]) : 6969;
+    int workerThreads = argc > 2 ? atoi(argv[2]) : 0;
+    int eventLoops = argc > 3 ? atoi(argv[3]) : 1;
+
+    RpcServer server(port, workerThreads, eventLoops);
+
+    server.Register<float(float, float)>("add", [](float a, float b) { return a + b; }, "a", "b");
+    server.Register<double(double, double)>("sub", [](double a, double b) { return a - b; }, "a", "b");
+    server.Register<float(float, float)>("mul", [](float a, float b) { return a * b; }, "a", "b");
+    server.Register<std::string(std::string)>("echo", [](std::string text) { return "Server echo: " + text; }, "text");
+
+    server.Register<void(std::string, int, int64_t)>("do_work", [&](std::string input, int delay, int64_t onComplete)
+    {
+        // The work takes delay milliseconds of this worker's time
+        printf("input: %s\nDelay: %d\n", input.c_str(), delay);
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+        server.TriggerCallback(onComplete, {{ "a", 1 }, { "b", "str" }, { "c", 3.33 }});
+    }, "input", "delay", "onComplete");
+
+    server.Register<int(int, int64_t, int)>("timer", [&](int interval, int64_t callback, int text)
+    {
+        auto timer = std::make_unique<Timer>();
+        timer->thread = std::thread([&server, state = timer.get(), interval, callback, text]()
+        {
+            // A callback that can't be delivered means the client is gone
+            while (!state->stopped)
+            {
+                if (!server.TriggerCallback(callback, {{ "text", text }}))
+                {
+                    state->finished = true;
+                    return;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+            }
+        });
+
+        std::lock_guard<std::mutex> timerLock(timerMutex);
+        ReapTimers();
+        timers[nextTimerHandle] = std::move(timer);
+        return nextTimerHandle++;
+    }, "interval", "callback", "text");
+
+    server.Register<bool(int)>("dispose_timer", [](int timerHandle)
+    {
+        std::unique_ptr<Timer> timer;
+        {
+            std::lock_guard<std::mutex> timerLock(timerMutex);
+            ReapTimers();
+            auto it = timers.find(timerHandle);
+            if (it == timers.end())
+                return false;
+            timer = std::move(it->second);
+            timers.erase(it);
+        }
+
+        printf("Handle disposed: %d\n", timerHandle);
+        timer->stopped = true;
+        timer->thread.join();
+        return true;
+    }, "timerHandle");
+
+    server.Register<void(int)>("AddToCounter", [](int) {}, "value");
+
+    // Takes a Blob<float> in place, or an array of numbers
+    server.Register<double(std::span<const float>)>("sum", [](std::span<const float> values)
+    {
+        double total = 0;
+        for (float value : values)
+            total += value;
+        return total;
+    }, "values");
+
+    server.Start();
+    server.Wait();
+    return 0;
+}
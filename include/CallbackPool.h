@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "MpmcQueue.h"
+
+
+// Fixed set of threads running callbacks posted by the receiver thread.
+// Tasks are handed over through a lock-free queue; idle workers sleep on
+// a counter of queued tasks. Post never waits: tasks may block on work
+// only the posting thread can finish, such as a callback making a Call
+// whose reply the receiver thread delivers.
+class CallbackPool
+{
+public:
+    using Task = std::function<void()>;
+
+    // logPrefix starts the pool's log lines, e.g. "[RPC Client]"
+    explicit CallbackPool(const char* logPrefix, size_t queueCapacity = 1024);
+    ~CallbackPool();
+
+    CallbackPool(const CallbackPool&) = delete;
+    CallbackPool& operator=(const CallbackPool&) = delete;
+
+    // Starts threadCount workers; the pool must be stopped
+    void Start(int threadCount);
+
+    // Runs what is already queued, overflow included, then joins the workers
+    void Stop();
+
+    // Tasks that don't fit in the queue go to a locked overflow list
+    void Post(Task task);
+
+private:
+    void Worker();
+    bool TakeOverflow(Task& task);
+
+    const char* logPrefix;
+    MpmcQueue<Task> queue;
+    std::mutex overflowMutex;
+    std::deque<Task> overflow;
+    std::atomic_int queued;
+    std::vector<std::thread> workers;
+};
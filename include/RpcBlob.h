@@ -0,0 +1,207 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+
+// Typed arrays that travel as raw little-endian bytes instead of JSON
+// numbers. In a payload document a blob argument is a marker object,
+//   {"$blob":{"dtype":"f32","shape":[n,3],"offset":o,"size":s}}
+// pointing into the blob section of an RPC_FLAG_BLOBS payload, or, where
+// there is no section, carrying its bytes as a binary value:
+//   {"$blob":{"dtype":"f32","shape":[n,3],"bytes":<binary>}}
+//
+// An RPC_FLAG_BLOBS payload is the blobs, each starting at a multiple of
+// BLOB_ALIGNMENT, then the document, then the document's size as a
+// little-endian uint32.
+
+static_assert(std::endian::native == std::endian::little, "Blobs are sent in host byte order");
+
+constexpr const char* BLOB_KEY = "$blob";
+
+// Views into the payload can be cast to any element type
+constexpr size_t BLOB_ALIGNMENT = 16;
+
+template <typename T>
+struct BlobTraits;
+
+#define RPC_BLOB_DTYPE(type, name) \
+    template <> struct BlobTraits<type> { static constexpr const char* dtype = name; };
+
+RPC_BLOB_DTYPE(uint8_t, "u8")
+RPC_BLOB_DTYPE(int8_t, "i8")
+RPC_BLOB_DTYPE(uint16_t, "u16")
+RPC_BLOB_DTYPE(int16_t, "i16")
+RPC_BLOB_DTYPE(uint32_t, "u32")
+RPC_BLOB_DTYPE(int32_t, "i32")
+RPC_BLOB_DTYPE(uint64_t, "u64")
+RPC_BLOB_DTYPE(int64_t, "i64")
+RPC_BLOB_DTYPE(float, "f32")
+RPC_BLOB_DTYPE(double, "f64")
+
+#undef RPC_BLOB_DTYPE
+
+// Element size of a dtype; 0 if unknown
+inline size_t BlobElementSize(std::string_view dtype)
+{
+    if (dtype == "u8" || dtype == "i8")
+        return 1;
+    if (dtype == "u16" || dtype == "i16")
+        return 2;
+    if (dtype == "u32" || dtype == "i32" || dtype == "f32")
+        return 4;
+    if (dtype == "u64" || dtype == "i64" || dtype == "f64")
+        return 8;
+    return 0;
+}
+
+// A blob argument as a handler sees it; the bytes stay valid until it returns
+struct RpcBlob
+{
+    std::string dtype;
+    std::vector<size_t> shape;
+    std::span<const std::byte> bytes;
+
+    template <typename T>
+    std::span<const T> As() const
+    {
+        if (dtype != BlobTraits<T>::dtype)
+            throw std::runtime_error("Blob holds " + dtype + ", not " + BlobTraits<T>::dtype);
+        return { reinterpret_cast<const T*>(bytes.data()), bytes.size() / sizeof(T) };
+    }
+};
+
+using RpcBlobs = std::unordered_map<std::string, RpcBlob>;
+
+inline bool IsBlob(const nlohmann::json& value)
+{
+    return value.is_object() && value.size() == 1 && value.begin().key() == BLOB_KEY && value.begin()->is_object();
+}
+
+// Blob section of a payload being built
+struct BlobSection
+{
+    std::string bytes;
+    bool used = false;
+
+    // Copies an inline marker's bytes into the section and returns the
+    // marker pointing at them
+    nlohmann::json Append(const nlohmann::json& marker)
+    {
+        const nlohmann::json& blob = marker[BLOB_KEY];
+        const nlohmann::json::binary_t& data = blob["bytes"].get_binary();
+
+        bytes.resize((bytes.size() + BLOB_ALIGNMENT - 1) / BLOB_ALIGNMENT * BLOB_ALIGNMENT);
+        size_t offset = bytes.size();
+        bytes.append(reinterpret_cast<const char*>(data.data()), data.size());
+        used = true;
+
+        nlohmann::json descriptor = {
+            { "dtype", blob["dtype"] },
+            { "shape", blob["shape"] },
+            { "offset", offset },
+            { "size", data.size() }
+        };
+        return {{ BLOB_KEY, std::move(descriptor) }};
+    }
+
+    // The whole payload around an encoded document
+    std::string Finish(const std::string& document)
+    {
+        bytes.resize((bytes.size() + BLOB_ALIGNMENT - 1) / BLOB_ALIGNMENT * BLOB_ALIGNMENT);
+        bytes.append(document);
+        uint32_t documentSize = uint32_t(document.size());
+        bytes.append(reinterpret_cast<const char*>(&documentSize), sizeof(documentSize));
+        return std::move(bytes);
+    }
+};
+
+// The document of an RPC_FLAG_BLOBS payload; false if malformed
+inline bool BlobDocument(std::string_view payload, std::string_view& document)
+{
+    uint32_t documentSize;
+    if (payload.size() < sizeof(documentSize))
+        return false;
+    memcpy(&documentSize, payload.data() + payload.size() - sizeof(documentSize), sizeof(documentSize));
+    if (documentSize > payload.size() - sizeof(documentSize))
+        return false;
+
+    document = payload.substr(payload.size() - sizeof(documentSize) - documentSize, documentSize);
+    return true;
+}
+
+// Views a marker's bytes in the payload, or inline; throws if they don't
+// match its dtype and shape
+inline RpcBlob ResolveBlob(const nlohmann::json& marker, std::string_view payload)
+{
+    const nlohmann::json& blob = marker[BLOB_KEY];
+    RpcBlob resolved;
+    resolved.dtype = blob.value("dtype", "");
+    resolved.shape = blob.value("shape", std::vector<size_t>());
+
+    size_t elementSize = BlobElementSize(resolved.dtype);
+    if (elementSize == 0)
+        throw std::runtime_error("Unknown blob dtype: " + resolved.dtype);
+
+    // The shape comes off the wire, so its byte size may not fit in size_t
+    size_t expected = elementSize;
+    for (size_t extent : resolved.shape)
+    {
+        if (extent != 0 && expected > SIZE_MAX / extent)
+            throw std::runtime_error("Blob shape too large");
+        expected *= extent;
+    }
+
+    auto bytes = blob.find("bytes");
+    if (bytes != blob.end() && bytes->is_binary())
+    {
+        const nlohmann::json::binary_t& data = bytes->get_binary();
+        resolved.bytes = { reinterpret_cast<const std::byte*>(data.data()), data.size() };
+    }
+    else
+    {
+        size_t offset = blob.value("offset", size_t(0));
+        size_t size = blob.value("size", size_t(0));
+        if (offset % BLOB_ALIGNMENT != 0 || offset > payload.size() || size > payload.size() - offset)
+            throw std::runtime_error("Blob outside the payload");
+        resolved.bytes = { reinterpret_cast<const std::byte*>(payload.data() + offset), size };
+    }
+
+    if (resolved.bytes.size() != expected)
+        throw std::runtime_error("Blob size doesn't match its shape");
+    return resolved;
+}
+
+// A blob as a flat array of numbers, for peers that don't know blobs
+inline nlohmann::json BlobToArray(const RpcBlob& blob)
+{
+    auto numbers = [&](auto element)
+    {
+        using T = decltype(element);
+        std::span<const T> values = blob.As<T>();
+        nlohmann::json array = nlohmann::json::array();
+        array.get_ref<nlohmann::json::array_t&>().assign(values.begin(), values.end());
+        return array;
+    };
+
+    if (blob.dtype == "u8") return numbers(uint8_t());
+    if (blob.dtype == "i8") return numbers(int8_t());
+    if (blob.dtype == "u16") return numbers(uint16_t());
+    if (blob.dtype == "i16") return numbers(int16_t());
+    if (blob.dtype == "u32") return numbers(uint32_t());
+    if (blob.dtype == "i32") return numbers(int32_t());
+    if (blob.dtype == "u64") return numbers(uint64_t());
+    if (blob.dtype == "i64") return numbers(int64_t());
+    if (blob.dtype == "f32") return numbers(float());
+    return numbers(double());
+}
@@ -1,62 +1,83 @@
 #pragma once
 
-#ifdef _WIN32
-#define NOMINMAX
-#include <WinSock2.h>
-#pragma comment(lib, "Ws2_32.lib")  // Optional backup
-#define SOCKET_TYPE SOCKET
-#else
-#define SOCKET_TYPE int
-#endif
-
 #include <string>
+#include <cstdint>
 #include <functional>
 #include <unordered_map>
 #include <thread>
 #include <mutex>
+#include <shared_mutex>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <coroutine>
+#include <exception>
+#include <array>
+#include <tuple>
+#include <span>
+#include <vector>
 
 #include <nlohmann/json.hpp>
 
+#include "RpcProtocol.h"
+#include "RpcCodec.h"
+#include "RpcBlob.h"
+#include "RpcStub.h"
+#include "RpcStats.h"
+#include "RpcTransport.h"
+#include "CallbackPool.h"
 
-struct RpcRequest
-{
-    struct {
-        int clientId;
-        char functionName[64];
-        int bufferSize;
-    } header;
-
-    std::string jsonArgs;
-};
-
-struct ResponseHeader
-{
-    enum class MsgType {
-        MSG_CALLBACK = 0,
-        MSG_RETURN = 1
-    };
-
-    int clientId;
-    MsgType msgType;
-    union {
-        int callbackId;
-        int statusCode;
-    } u;
-
-    int bufferSize;
-};
 
 class RpcClient
 {
 public:
-    static RpcClient& Get(int port = 6969, bool isNode = false)
+    static RpcClient& Get(int port = 6969, bool isNode = false, TransportType transport = TransportType::TCP)
+    {
+        return Get([&]() { return CreateTransport(transport, port); }, isNode);
+    }
+
+    // The first Get creates the client; makeTransport lets it run over a
+    // custom ITransport backend
+    static RpcClient& Get(const std::function<std::unique_ptr<ITransport>()>& makeTransport, bool isNode = false)
     {
-        static RpcClient rpcClient{port, isNode};
+        static RpcClient rpcClient{makeTransport(), isNode};
         return rpcClient;
     }
 
     using Callback = std::function<void(const nlohmann::json&)>;
 
+    // Typed array argument, sent as raw little-endian bytes after the
+    // payload document instead of as JSON numbers:
+    //   client.Call("upload", {{"vertices", RpcClient::Blob<float>(vertices, {count, 3})}});
+    // Servers without blob support, and JSON-format connections, get a flat
+    // array of numbers. Used like this, the bytes are copied three times:
+    // to_json copies them into the marker's binary value, the braced
+    // argument list is copied into the vector Call takes, and the blob
+    // section copies them into the payload.
+    template <typename T>
+    struct Blob
+    {
+        Blob(std::span<const T> data, std::vector<size_t> shape = {}):
+            data(data), shape(shape.empty() ? std::vector<size_t>{ data.size() } : std::move(shape))
+        {
+        }
+
+        std::span<const T> data;
+        std::vector<size_t> shape;
+
+        friend void to_json(nlohmann::json& json, const Blob& blob)
+        {
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(blob.data.data());
+            nlohmann::json marker = {
+                { "dtype", BlobTraits<T>::dtype },
+                { "shape", blob.shape },
+                { "bytes", nlohmann::json::binary_t(std::vector<uint8_t>(bytes, bytes + blob.data.size_bytes())) }
+            };
+            json = {{ BLOB_KEY, std::move(marker) }};
+        }
+    };
+
     // Make a call with arguments and optional callbacks
     nlohmann::json Call(
         const std::string& functionName,
@@ -66,39 +87,282 @@ public:
 
     std::string Call(const std::string& functionName, const std::string& jsonArgs);
 
+    // One-way call: returns once the request is sent, and the server sends
+    // no response. Failures on the server side go unnoticed.
+    void Notify(
+        const std::string& functionName,
+        const std::vector<std::pair<std::string, nlohmann::json>>& dataArgs = {},
+        const std::vector<std::pair<std::string, Callback>>& callbackArgs = {}
+    );
+
+    struct BatchEntry
+    {
+        std::string functionName;
+        std::vector<std::pair<std::string, nlohmann::json>> dataArgs;
+        std::vector<std::pair<std::string, Callback>> callbackArgs;
+    };
+
+    struct BatchResult
+    {
+        int statusCode;         // 0 on success; otherwise result holds the error
+        nlohmann::json result;
+    };
+
+    // Runs all entries back to back on the server in one request and one
+    // response. Without a negotiated document format, or against servers
+    // that didn't grant batches, the calls are pipelined instead. A batch the
+    // server rejects as a whole fails every entry with its error.
+    std::vector<BatchResult> CallBatch(std::span<const BatchEntry> entries);
+
+    // Send a call without waiting; the future is fulfilled by the receiver thread
+    std::future<nlohmann::json> CallAsync(
+        const std::string& functionName,
+        const std::vector<std::pair<std::string, nlohmann::json>>& dataArgs = {},
+        const std::vector<std::pair<std::string, Callback>>& callbackArgs = {}
+    );
+
+    // Awaitable returned by CallCo. The coroutine is resumed on the receiver
+    // thread (or via the resume executor), so it must co_await further calls
+    // rather than make blocking ones.
+    class CallAwaiter
+    {
+    public:
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle);
+        nlohmann::json await_resume();
+
+    private:
+        friend class RpcClient;
+        CallAwaiter(RpcClient& client, RpcRequest request);
+
+        RpcClient& client;
+        RpcRequest request;
+        nlohmann::json result;
+        std::exception_ptr error;
+    };
+
+    // Make a call from a coroutine: auto result = co_await client.CallCo(...)
+    // GCC 12 rejects braced arguments inside the co_await expression ("array
+    // used as initializer"), whatever the parameter type; make the awaiter
+    // first there:
+    //   auto sub = client.CallCo("sub", {{"a", 5}, {"b", 2}});
+    //   nlohmann::json d = co_await sub;
+    CallAwaiter CallCo(
+        const std::string& functionName,
+        const std::vector<std::pair<std::string, nlohmann::json>>& dataArgs = {},
+        const std::vector<std::pair<std::string, Callback>>& callbackArgs = {}
+    );
+
+    template <typename Signature>
+    class Binding;
+
+    // Typed stub that encodes its arguments straight into the request and
+    // decodes the result into the declared return type:
+    //   auto sub = client.Bind<double(double, double)>("sub", "a", "b");
+    //   double d = sub(5, 2);
+    // Failed calls throw std::runtime_error with the server's message.
+    template <typename Signature, typename... Names>
+    Binding<Signature> Bind(const std::string& functionName, Names... argNames);
+
+    using Executor = std::function<void(std::function<void()>)>;
+
+    // Where CallCo coroutines resume; unset resumes inline on the receiver thread.
+    // Set before the first CallCo.
+    void SetResumeExecutor(Executor executor);
+
     void RegisterCallbackHandler(std::function<void(int, const std::string&)> fn);
 
+    // Number of threads running callbacks (default 2). Set before the first
+    // call that passes callbacks. Callbacks may make calls of their own,
+    // blocking ones included; the receiver never waits on the callback threads.
+    void SetCallbackThreads(int count);
+
+    // Agrees with the server on the first of the preferred formats it
+    // speaks, falling back to JSON; old servers always keep JSON. The client
+    // offers MessagePack, CBOR, NativeJSON when it connects. Call while no
+    // other calls are in flight.
+    WireFormat Negotiate(const std::vector<WireFormat>& preferred);
+
+    // Upper bound on spin iterations before a waiting caller blocks; 0 always blocks
+    void SetSpinLimit(int iterations);
+
     int GetClientId() { return clientId; }
 
+    // Call counts, bytes, errors and latency per function name since the
+    // client connected, internal _RPC:: calls included
+    std::vector<FunctionStats> GetStats();
+
 private:
-    RpcClient(int port, bool isNode);
+    RpcClient(std::unique_ptr<ITransport> backend, bool isNode);
     ~RpcClient();
 
     RpcClient(const RpcClient&) = delete;
     const RpcClient& operator=(const RpcClient&) = delete;
 
-    nlohmann::json ProcessRPC(const RpcRequest& req);
-    int RegisterCallback(Callback cb);
-    
-    static void ProcessCallback(
-        const std::unordered_map<int, Callback>& cbRegistry,
-        const ResponseHeader& respHeader,
-        const std::string& respArgsJson
+    // A call waiting for its MSG_RETURN, matched by request ID
+    struct PendingCall
+    {
+        std::atomic_bool ready{false};
+        ResponseHeader responseHeader;
+        std::string responsePayload;
+
+        // Set when sent by name in compact mode, to record the method ID returned
+        std::string resolving;
+
+        // If set, invoked by the receiver instead of waking a waiter
+        std::function<void(PendingCall&)> onReturn;
+
+        // Name interned by stats, and when the request started going out
+        const std::string* function = nullptr;
+        std::chrono::steady_clock::time_point sent;
+    };
+
+    // Without flags, blob arguments go as arrays of numbers; with them, they
+    // may go in a blob section, and RPC_FLAG_BLOBS is added
+    std::string EncodeArgs(
+        WireFormat format,
+        const std::vector<std::pair<std::string, nlohmann::json>>& dataArgs,
+        const std::vector<std::pair<std::string, Callback>>& callbackArgs,
+        uint8_t* flags = nullptr
+    );
+    nlohmann::json ArgsDocument(
+        const std::vector<std::pair<std::string, nlohmann::json>>& dataArgs,
+        const std::vector<std::pair<std::string, Callback>>& callbackArgs,
+        BlobSection* blobs = nullptr
+    );
+    std::vector<BatchResult> PipelineBatch(std::span<const BatchEntry> entries, WireFormat format);
+    RpcRequest MakeRequest(const std::string& functionName, std::string jsonArgs, WireFormat format = WireFormat::JSON, uint8_t flags = 0);
+    RpcRequest MakeCall(
+        const std::string& functionName,
+        WireFormat format,
+        const std::vector<std::pair<std::string, nlohmann::json>>& dataArgs,
+        const std::vector<std::pair<std::string, Callback>>& callbackArgs
     );
+    void SendRPC(RpcRequest& req, std::shared_ptr<PendingCall> call);  // One-way without a call
+    nlohmann::json DecodeReturn(const RpcRequest& req, const PendingCall& call);
+
+    nlohmann::json ProcessRPC(RpcRequest& req);
+
+    // Agrees on the format and every connection feature the transport and
+    // server allow in one _RPC::Negotiate round trip
+    void Handshake(const std::vector<WireFormat>& preferred);
+
+    // The decoded reply, or null if the server failed the call; features
+    // are only asked for if not null
+    nlohmann::json Negotiate(const std::vector<WireFormat>& preferred, const nlohmann::json& features);
+    static WireFormat ChosenFormat(const std::vector<WireFormat>& preferred, const nlohmann::json& name);
+    void Resume(std::coroutine_handle<> handle);
+    void WaitForReturn(PendingCall& call);
+    int64_t RegisterCallback(Callback cb);
+    void UnregisterCallbacks(const std::vector<int64_t>& ids);
+    void ProcessCallback(const ResponseHeader& respHeader, const std::string& respArgsJson);
 
 private:
-    SOCKET_TYPE clientSocket;
+    std::unique_ptr<ITransport> transport;
     int clientId;
     bool isNode;
+    std::atomic<WireFormat> wireFormat;
+
+    // _RPC::Batch runs batches in one request
+    bool batchSupported;
+
+    // Payloads of FD_PAYLOAD_THRESHOLD bytes or more go as RPC_FLAG_MEMFD
+    bool fdPayloads;
+
+    // Blob arguments go in a blob section in document formats
+    bool blobPayloads;
+
+    // Method IDs of function names, once the server has resolved them
+    bool compactHeaders;
+    std::shared_mutex methodMutex;
+    std::unordered_map<std::string, uint16_t> methodIds;
+
+    std::atomic_int nextRequestId;
+    std::mutex pendingMutex;
+    std::unordered_map<int, std::shared_ptr<PendingCall>> pendingCalls;
 
-    ResponseHeader responseHeader;
-    std::string responseArgsJson;
+    std::atomic_int spinLimit;
+    std::atomic_int spinBudget;
 
-    std::atomic_bool rpcReturnValueReady;
     std::mutex callMutex;
     std::thread receiver;
     std::atomic_bool running;
     
+    Executor resumeExecutor;
+    CallbackPool callbackPool;
     std::function<void(int, const std::string&)> callbackHandler;
-    std::unordered_map<int, Callback> callbackRegistry;
+
+    // Callback IDs are (clientId << 32) | nextCallbackId, so clients never
+    // collide and no server round trip is needed to allocate one
+    std::atomic_uint32_t nextCallbackId;
+    std::shared_mutex callbackMutex;
+    std::unordered_map<int64_t, Callback> callbackRegistry;
+
+    RpcStats stats;
 };
+
+
+template <typename R, typename... Args>
+class RpcClient::Binding<R(Args...)>
+{
+public:
+    R operator()(const Args&... args) const
+    {
+        WireFormat format = client.wireFormat;
+        PayloadWriter writer(format);
+        writer.BeginArgs(sizeof...(Args));
+
+        size_t i = 0;
+        (writer.Arg(argNames[i++], args), ...);
+
+        RpcRequest req = client.MakeRequest(functionName, writer.Finish(), format);
+        auto call = std::make_shared<PendingCall>();
+        client.SendRPC(req, call);
+        client.WaitForReturn(*call);
+
+        WireFormat returned = GetWireFormat(call->responseHeader.flags);
+        bool binary = returned == WireFormat::MessagePack || returned == WireFormat::CBOR;
+        if (binary && call->responseHeader.u.statusCode == 0)
+            return PayloadReader(returned, call->responsePayload).template Result<R>();
+
+        nlohmann::json result = client.DecodeReturn(req, *call);
+        if (call->responseHeader.u.statusCode != 0)
+            throw std::runtime_error(result.is_string() ? result.get<std::string>() : result.dump());
+
+        // Legacy JSON results only look typed when they parse as JSON
+        if constexpr (std::is_same_v<R, std::string>)
+            return result.is_string() ? result.get<std::string>() : result.dump();
+        else if constexpr (std::is_arithmetic_v<R>)
+        {
+            // NaN and infinities come back as null
+            if (!result.is_number() && !result.is_boolean())
+                throw std::runtime_error("[RPC Client] Result does not match the bound return type.");
+            return result.template get<R>();
+        }
+        else if constexpr (!std::is_void_v<R>)
+            return result.template get<R>();
+    }
+
+private:
+    friend class RpcClient;
+
+    template <typename... Names>
+    Binding(RpcClient& client, const std::string& functionName, Names... names):
+        client(client), functionName(functionName), argNames{ std::string(names)... }
+    {
+    }
+
+    RpcClient& client;
+    std::string functionName;
+    std::array<std::string, sizeof...(Args)> argNames;
+};
+
+template <typename Signature, typename... Names>
+RpcClient::Binding<Signature> RpcClient::Bind(const std::string& functionName, Names... argNames)
+{
+    static_assert(
+        sizeof...(Names) == std::tuple_size_v<decltype(Binding<Signature>::argNames)>,
+        "Bind needs one argument name per parameter"
+    );
+    return Binding<Signature>(*this, functionName, argNames...);
+}
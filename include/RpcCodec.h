@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "RpcProtocol.h"
+
+
+// Payloads in the negotiated wire formats are a single document; JSON
+// payloads keep their historic nested-string layout and are handled by the
+// callers.
+
+inline std::string EncodePayload(WireFormat format, const nlohmann::json& document)
+{
+    std::vector<uint8_t> bytes;
+    if (format == WireFormat::MessagePack)
+        nlohmann::json::to_msgpack(document, bytes);
+    else if (format == WireFormat::CBOR)
+        nlohmann::json::to_cbor(document, bytes);
+    else
+        return document.dump();
+    return std::string(bytes.begin(), bytes.end());
+}
+
+// Discarded on malformed input
+inline nlohmann::json DecodePayload(WireFormat format, std::string_view payload)
+{
+    if (format == WireFormat::MessagePack)
+        return nlohmann::json::from_msgpack(payload.begin(), payload.end(), true, false);
+    if (format == WireFormat::CBOR)
+        return nlohmann::json::from_cbor(payload.begin(), payload.end(), true, false);
+    return nlohmann::json::parse(payload.begin(), payload.end(), nullptr, false);
+}
+
+// Every format this library speaks, for servers answering _RPC::Negotiate
+constexpr WireFormat ALL_FORMATS[] = {
+    WireFormat::JSON, WireFormat::MessagePack, WireFormat::CBOR, WireFormat::NativeJSON
+};
+
+inline const char* WireFormatName(WireFormat format)
+{
+    switch (format)
+    {
+    case WireFormat::MessagePack: return "msgpack";
+    case WireFormat::CBOR: return "cbor";
+    case WireFormat::NativeJSON: return "json-native";
+    default: return "json";
+    }
+}
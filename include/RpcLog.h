@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+
+
+enum class LogLevel
+{
+    Trace = 0,      // Every call and its result
+    Debug = 1,
+    Info = 2,
+    Warning = 3,
+    Error = 4,
+    Off = 5
+};
+
+// Statements below this level are compiled out, arguments included. Build
+// with -DRPC_LOG_MIN_LEVEL=0 to keep trace logging.
+#ifndef RPC_LOG_MIN_LEVEL
+#define RPC_LOG_MIN_LEVEL 1
+#endif
+
+#define RPC_LOG(level, ...) do                          \
+    {                                                   \
+        if (RpcLog::Enabled(level))                     \
+            RpcLog::Write(level, __VA_ARGS__);          \
+    } while (0)
+
+// Never evaluated, but still names its arguments, so what only a
+// compiled-out statement uses doesn't look unused
+#define RPC_LOG_DISABLED(level, ...) do                 \
+    {                                                   \
+        if (false)                                      \
+            RpcLog::Write(level, __VA_ARGS__);          \
+    } while (0)
+
+#if RPC_LOG_MIN_LEVEL <= 0
+#define RPC_LOG_TRACE(...) RPC_LOG(LogLevel::Trace, __VA_ARGS__)
+#else
+#define RPC_LOG_TRACE(...) RPC_LOG_DISABLED(LogLevel::Trace, __VA_ARGS__)
+#endif
+
+#if RPC_LOG_MIN_LEVEL <= 1
+#define RPC_LOG_DEBUG(...) RPC_LOG(LogLevel::Debug, __VA_ARGS__)
+#else
+#define RPC_LOG_DEBUG(...) RPC_LOG_DISABLED(LogLevel::Debug, __VA_ARGS__)
+#endif
+
+#if RPC_LOG_MIN_LEVEL <= 2
+#define RPC_LOG_INFO(...) RPC_LOG(LogLevel::Info, __VA_ARGS__)
+#else
+#define RPC_LOG_INFO(...) RPC_LOG_DISABLED(LogLevel::Info, __VA_ARGS__)
+#endif
+
+#if RPC_LOG_MIN_LEVEL <= 3
+#define RPC_LOG_WARNING(...) RPC_LOG(LogLevel::Warning, __VA_ARGS__)
+#else
+#define RPC_LOG_WARNING(...) RPC_LOG_DISABLED(LogLevel::Warning, __VA_ARGS__)
+#endif
+
+#if RPC_LOG_MIN_LEVEL <= 4
+#define RPC_LOG_ERROR(...) RPC_LOG(LogLevel::Error, __VA_ARGS__)
+#else
+#define RPC_LOG_ERROR(...) RPC_LOG_DISABLED(LogLevel::Error, __VA_ARGS__)
+#endif
+
+
+// Process-wide log settings for the client library
+class RpcLog
+{
+public:
+    using Sink = std::function<void(LogLevel, const std::string&)>;
+
+    // Runtime threshold on top of RPC_LOG_MIN_LEVEL; Info by default
+    static void SetLevel(LogLevel level) { threshold.store(level, std::memory_order_relaxed); }
+
+    static bool Enabled(LogLevel level)
+    {
+        return level >= threshold.load(std::memory_order_relaxed);
+    }
+
+    // Where formatted lines go; stdout when unset
+    static void SetSink(Sink sink);
+
+    // Hands lines to a background thread, so logging never waits on the
+    // sink. Lines are dropped while its queue is full.
+    static void SetAsync(bool async);
+
+#if defined(__GNUC__)
+    __attribute__((format(printf, 2, 3)))
+#endif
+    static void Write(LogLevel level, const char* format, ...);
+
+private:
+    static std::atomic<LogLevel> threshold;
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+
+// Encoding of a message's payload, carried in the low bits of the header
+// flags. Servers that predate flags send zeros, i.e. JSON.
+enum class WireFormat : uint8_t
+{
+    JSON = 0,           // {"keys":[...],"values":[...]} / {"result":"..."}
+    MessagePack = 1,    // {"args":{...},"callbacks":[...]} / {"result":...}
+    CBOR = 2,           // Same layout as MessagePack
+    NativeJSON = 3      // Same layout as MessagePack, as JSON text
+};
+
+constexpr uint8_t RPC_FLAG_FORMAT_MASK = 0x03;
+
+// The caller doesn't wait for a result; servers that know this flag send no
+// MSG_RETURN. One-way requests use request ID 0, so replies from servers
+// that don't know it can be told apart and dropped.
+constexpr uint8_t RPC_FLAG_ONEWAY = 0x04;
+
+// The payload isn't in the frame, whose bufferSize is 0: it fills a sealed
+// memfd passed with the header as SCM_RIGHTS over an AF_UNIX socket. Only
+// sent once the server granted RPC_FEATURE_MEMFD.
+constexpr uint8_t RPC_FLAG_MEMFD = 0x08;
+
+// The payload starts with raw blob arguments, which the document's blob
+// markers point at, and ends with the document's size; see RpcBlob.h. Only
+// sent in document formats once the server granted RPC_FEATURE_BLOBS.
+constexpr uint8_t RPC_FLAG_BLOBS = 0x10;
+
+// Connection features a client asks _RPC::Negotiate for, along with its
+// formats. The reply is {"format":...,"features":[...]} with those granted,
+// all in effect from the next request on; servers that predate features
+// answer with the format's name alone.
+inline constexpr char RPC_FEATURE_COMPACT_HEADERS[] = "compact-headers";
+inline constexpr char RPC_FEATURE_MEMFD[] = "memfd";
+inline constexpr char RPC_FEATURE_BLOBS[] = "blobs";
+inline constexpr char RPC_FEATURE_BATCH[] = "batch";
+
+inline WireFormat GetWireFormat(uint8_t flags)
+{
+    return WireFormat(flags & RPC_FLAG_FORMAT_MASK);
+}
+
+struct RpcRequest
+{
+    struct {
+        int clientId;
+        int requestId;
+        char functionName[63];
+        uint8_t flags;
+        int bufferSize;
+    } header;
+
+    std::string jsonArgs;
+};
+
+// Sent instead of RpcRequest::header once the server granted
+// RPC_FEATURE_COMPACT_HEADERS. Method 0 means unresolved: nameLength bytes
+// of the function name follow the header, and the response carries the ID
+// to use from then on. The payload follows in both cases.
+struct CompactRequestHeader
+{
+    int requestId;
+    uint16_t methodId;
+    uint8_t flags;
+    uint8_t nameLength;
+    int bufferSize;
+};
+
+struct ResponseHeader
+{
+    enum class MsgType : uint8_t {
+        MSG_CALLBACK = 0,
+        MSG_RETURN = 1
+    };
+
+    int clientId;
+    int requestId;
+    MsgType msgType;
+    uint8_t flags;
+    uint16_t methodId;  // Answer to an unresolved compact request; 0 otherwise
+    union {
+        int callbackId;
+        int statusCode;
+    } u;
+
+    int bufferSize;
+};
+
+// All mirror packed C# structs; msgType, flags and methodId overlay the
+// little-endian int the original protocol sent as the message type
+static_assert(sizeof(RpcRequest::header) == 76, "Request header must match the server");
+static_assert(sizeof(CompactRequestHeader) == 12, "Request header must match the server");
+static_assert(sizeof(ResponseHeader) == 20, "Response header must match the server");
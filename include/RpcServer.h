@@ -0,0 +1,292 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "RpcProtocol.h"
+#include "RpcBlob.h"
+#include "CallbackPool.h"
+
+
+// Native counterpart of the C# RpcServer (server/rpc.cs), speaking the same
+// protocol: JSON, MessagePack, CBOR and native JSON payloads, compact
+// headers, batches, one-way calls, callbacks and shared-memory rings. Edge-triggered epoll
+// threads own the connections and read their requests; a pool of workers
+// runs the handlers. Replies go out without blocking: what the socket
+// doesn't take is queued on the connection and flushed by its event loop.
+// Blob arguments (RPC_FLAG_BLOBS) reach handlers as views into the request.
+// Linux only.
+//
+// Like the C# server, each connection's requests run one at a time and in
+// the order they were sent, one-way calls included; different connections
+// run side by side on the workers.
+class RpcServer
+{
+public:
+    // Named arguments in, result out. Runs on a worker thread, so handlers
+    // must be thread-safe; a thrown exception fails the call with its message.
+    using Handler = std::function<nlohmann::json(const nlohmann::json& args)>;
+
+    // Also gets the blob arguments, which stay in args as their markers.
+    // Plain Handlers see them as arrays of numbers.
+    using BlobHandler = std::function<nlohmann::json(const nlohmann::json& args, const RpcBlobs& blobs)>;
+
+    // Listens on TCP port and on the AF_UNIX stream socket UnixSocketPath(port).
+    // workerThreads 0 uses one per hardware thread. More than one event loop
+    // gives each its own SO_REUSEPORT listener, so the kernel spreads new
+    // TCP clients over them; eventLoops 0 runs one per hardware thread.
+    explicit RpcServer(int port = 6969, int workerThreads = 0, int eventLoops = 1);
+    ~RpcServer();
+
+    RpcServer(const RpcServer&) = delete;
+    RpcServer& operator=(const RpcServer&) = delete;
+
+    // Register everything before Start
+    void Register(const std::string& name, Handler handler);
+    void Register(const std::string& name, BlobHandler handler);
+
+    // Typed handler with one name per parameter, e.g.
+    //   server.Register<double(double, double)>("sub", [](double a, double b) { return a - b; }, "a", "b");
+    // std::span<const T> parameters view blobs in place, or a copy of an
+    // array of numbers; RpcBlob parameters take blobs only.
+    template <typename Signature, typename Function, typename... Names>
+    void Register(const std::string& name, Function function, Names... argNames);
+
+    // Starts accepting clients in the background
+    void Start();
+
+    // Closes every connection and joins all threads
+    void Stop();
+
+    // Blocks until Stop is called from another thread
+    void Wait();
+
+    // Calls a callback a client passed in, with namedArgs as its arguments.
+    // False if the callback is unknown or its client is gone.
+    bool TriggerCallback(int64_t callbackId, const nlohmann::json& namedArgs);
+
+private:
+    struct Connection;
+    struct Request;
+
+    // One epoll thread and the connections it accepted
+    struct EventLoop
+    {
+        int epollFd = -1;
+        int wakeFd = -1;
+        int tcpListener = -1;
+        std::thread thread;
+
+        // Only touched by the loop's own thread
+        std::unordered_map<int, std::shared_ptr<Connection>> connections;
+
+        // Connections that stopped reading with bytes left, so one busy
+        // client can't starve the others; edge triggering won't report them again
+        std::vector<int> backlog;
+    };
+
+    enum class ReadStatus
+    {
+        Drained,    // Read until EAGAIN
+        More,       // Stopped early; resume from the backlog
+        Closed
+    };
+
+    struct Method
+    {
+        std::string name;
+        std::function<nlohmann::json(Connection&, const nlohmann::json&, const RpcBlobs&)> invoke;
+    };
+
+    template <typename R, typename... Args, typename... Names>
+    void RegisterTyped(const std::string& name, std::function<R(Args...)> function, Names... argNames);
+
+    template <typename R, typename... Args, size_t... I>
+    static nlohmann::json Invoke(
+        const std::function<R(Args...)>& function,
+        const std::array<std::string, sizeof...(Args)>& names,
+        const nlohmann::json& args,
+        const RpcBlobs& blobs,
+        std::index_sequence<I...>
+    );
+
+    // A typed handler's argument, converted for the duration of the call
+    template <typename T>
+    struct ArgumentValue;
+
+    static const nlohmann::json& Argument(const nlohmann::json& args, const std::string& name);
+
+    void AddMethod(const std::string& name, std::function<nlohmann::json(Connection&, const nlohmann::json&, const RpcBlobs&)> invoke);
+    uint16_t FindMethodId(const std::string& name) const;
+
+    int Listen(int family);
+    void Run(EventLoop& loop);
+    void Accept(EventLoop& loop, int listener);
+    ReadStatus ReadRequests(EventLoop& loop, Connection& connection);
+    void CloseConnection(EventLoop& loop, int fd);
+
+    // Fills request from a header; false if it is corrupt
+    bool DecodeHeader(const Connection& connection, const char* data, Request& request, int& bufferSize, size_t& nameLength) const;
+    void ResolveName(const Connection& connection, Request& request, const char* name, size_t nameLength) const;
+
+    // Whether a full-header request turns on CompactRequestHeader for the
+    // requests behind it, which is decided as it is read
+    bool SwitchesToCompact(Connection& connection, const Request& request);
+
+    // Maps the client's segment and starts reading requests from it
+    void AttachSharedMemory(Connection& connection, const std::string& name, uint32_t capacity);
+    void ReadSharedMemory(std::shared_ptr<Connection> self);
+    static void StopSharedMemory(Connection& connection);
+
+    // Requests of one connection run one at a time, in the order they came
+    void Enqueue(const std::shared_ptr<Connection>& self, Request request);
+    void Drain(std::shared_ptr<Connection> self);
+    void Handle(Connection& connection, Request& request);
+    nlohmann::json Dispatch(Connection& connection, uint16_t methodId, const std::string& name, uint8_t flags, std::string_view payload, int& status);
+    nlohmann::json DispatchBatch(Connection& connection, WireFormat format, std::string_view payload, std::string_view blobSection);
+    nlohmann::json ParseArgs(Connection& connection, WireFormat format, std::string_view payload);
+    nlohmann::json ParseDocumentArgs(Connection& connection, const nlohmann::json& document);
+    void RegisterCallbacks(Connection& connection, const nlohmann::json& callbacks);
+    static RpcBlobs ResolveBlobs(const nlohmann::json& args, std::string_view blobSection);
+    static std::string EncodeResult(WireFormat format, const nlohmann::json& result);
+
+    // Sends what the socket takes right away and queues the rest; false once
+    // the connection is gone or too far behind
+    static bool WriteFrame(Connection& connection, const ResponseHeader& header, const std::string& payload);
+
+    // Sends queued output; called by the event loop once the socket is writable
+    static bool FlushOutput(Connection& connection);
+
+    // Writes to the response ring instead; blocks while the client lags
+    static bool WriteSharedFrame(Connection& connection, const ResponseHeader& header, const std::string& payload);
+
+    int port;
+    int workerThreads;
+    int eventLoopCount;
+    std::string unixPath;
+
+    // Fixed once started; indexed by method ID, 0 standing for unresolved
+    std::vector<Method> methods;
+    std::unordered_map<std::string, uint16_t> methodIds;
+
+    // Shared by all loops; each wakes only one of them per new client
+    int unixListener;
+    std::vector<std::unique_ptr<EventLoop>> loops;
+    std::atomic_bool running;
+    CallbackPool workers;
+    std::atomic_int nextClientId;
+
+    // Who owns each callback, and the connection of each client
+    std::mutex clientMutex;
+    std::unordered_map<int, std::weak_ptr<Connection>> clients;
+    std::unordered_map<int64_t, int> callbackToClientId;
+    int64_t nextCallbackId;
+};
+
+
+template <typename Signature, typename Function, typename... Names>
+void RpcServer::Register(const std::string& name, Function function, Names... argNames)
+{
+    RegisterTyped(name, std::function<Signature>(std::move(function)), argNames...);
+}
+
+template <typename R, typename... Args, typename... Names>
+void RpcServer::RegisterTyped(const std::string& name, std::function<R(Args...)> function, Names... argNames)
+{
+    static_assert(sizeof...(Args) == sizeof...(Names), "Register needs one argument name per parameter");
+
+    std::array<std::string, sizeof...(Args)> names{ std::string(argNames)... };
+    Register(name, BlobHandler([function = std::move(function), names](const nlohmann::json& args, const RpcBlobs& blobs)
+    {
+        return Invoke(function, names, args, blobs, std::index_sequence_for<Args...>());
+    }));
+}
+
+template <typename T>
+struct RpcServer::ArgumentValue
+{
+    T value;
+
+    ArgumentValue(const nlohmann::json& args, const RpcBlobs& blobs, const std::string& name)
+    {
+        auto blob = blobs.find(name);
+        value = blob != blobs.end() ? BlobToArray(blob->second).template get<T>() : Argument(args, name).template get<T>();
+    }
+
+    T& Get() { return value; }
+};
+
+template <typename T>
+struct RpcServer::ArgumentValue<std::span<const T>>
+{
+    std::span<const T> view;
+    std::vector<T> copy;
+
+    ArgumentValue(const nlohmann::json& args, const RpcBlobs& blobs, const std::string& name)
+    {
+        auto blob = blobs.find(name);
+        if (blob != blobs.end())
+        {
+            view = blob->second.template As<T>();
+        }
+        else
+        {
+            copy = Argument(args, name).template get<std::vector<T>>();
+            view = copy;
+        }
+    }
+
+    std::span<const T> Get() { return view; }
+};
+
+template <>
+struct RpcServer::ArgumentValue<RpcBlob>
+{
+    RpcBlob value;
+
+    ArgumentValue(const nlohmann::json&, const RpcBlobs& blobs, const std::string& name)
+    {
+        auto blob = blobs.find(name);
+        if (blob == blobs.end())
+            throw std::runtime_error("Argument isn't a blob: " + name);
+        value = blob->second;
+    }
+
+    const RpcBlob& Get() { return value; }
+};
+
+template <typename R, typename... Args, size_t... I>
+nlohmann::json RpcServer::Invoke(
+    const std::function<R(Args...)>& function,
+    const std::array<std::string, sizeof...(Args)>& names,
+    const nlohmann::json& args,
+    const RpcBlobs& blobs,
+    std::index_sequence<I...>)
+{
+    // The converted values live until the call returns
+    if constexpr (std::is_void_v<R>)
+    {
+        function(ArgumentValue<std::decay_t<Args>>(args, blobs, names[I]).Get()...);
+        return nullptr;
+    }
+    else
+    {
+        return function(ArgumentValue<std::decay_t<Args>>(args, blobs, names[I]).Get()...);
+    }
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+// Log-linear histogram in the style of HdrHistogram: values below
+// SUB_BUCKETS are exact, above that each power of two is split into
+// SUB_BUCKETS steps, so any recorded value is off by at most ~3%.
+class LatencyHistogram
+{
+public:
+    static constexpr int SUB_BUCKET_BITS = 5;
+    static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr int MAX_VALUE_BITS = 40;     // Larger values are clamped
+    static constexpr int BUCKET_COUNT = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    static int BucketOf(uint64_t value);
+    static uint64_t HighestValueOf(int bucket);   // Largest value counted in the bucket
+
+    LatencyHistogram();
+
+    void Record(uint64_t value);
+    void Merge(const LatencyHistogram& other);
+
+    // Smallest value at or above the given percentage of samples, e.g. 99.9
+    uint64_t Percentile(double percent) const;
+
+    uint64_t Count() const { return count; }
+    uint64_t Max() const { return max; }
+    double Mean() const { return count ? double(total) / count : 0.0; }
+
+private:
+    friend class RpcStats;
+
+    std::vector<uint64_t> buckets;
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+};
+
+// What RpcClient::GetStats reports per function name
+struct FunctionStats
+{
+    std::string function;
+    uint64_t calls = 0;             // Requests sent, one-way ones included
+    uint64_t errors = 0;            // Returns with a nonzero status
+    uint64_t bytesSent = 0;         // Whole frames, headers included
+    uint64_t bytesReceived = 0;
+    LatencyHistogram latency;       // Nanoseconds from send to MSG_RETURN
+};
+
+// Per-function counters. Every thread counts into its own shard with plain
+// relaxed stores, and a snapshot merges the shards, so recording never
+// takes a lock or a contended cache line.
+class RpcStats
+{
+public:
+    RpcStats();
+
+    RpcStats(const RpcStats&) = delete;
+    RpcStats& operator=(const RpcStats&) = delete;
+
+    // Returns the function name with a lifetime of this object, for
+    // handing to RecordReturn from another thread
+    const std::string& RecordSend(std::string_view function, uint64_t bytes);
+    void RecordReturn(const std::string& function, std::chrono::nanoseconds latency, uint64_t bytes, bool error);
+
+    // Sorted by function name
+    std::vector<FunctionStats> Snapshot();
+
+private:
+    struct Counters
+    {
+        std::atomic_uint64_t calls{0};
+        std::atomic_uint64_t errors{0};
+        std::atomic_uint64_t bytesSent{0};
+        std::atomic_uint64_t bytesReceived{0};
+        std::atomic_uint64_t totalNanoseconds{0};
+        std::atomic_uint64_t maxNanoseconds{0};
+        std::array<std::atomic_uint64_t, LatencyHistogram::BUCKET_COUNT> buckets{};
+    };
+
+    struct NameHash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view name) const { return std::hash<std::string_view>()(name); }
+    };
+
+    // Written only by its thread. The mutex guards the map's shape: held to
+    // add a function and to read, never to count.
+    struct Shard
+    {
+        std::mutex mutex;
+        std::unordered_map<std::string, std::unique_ptr<Counters>, NameHash, std::equal_to<>> functions;
+    };
+
+    Shard& LocalShard();
+    std::pair<const std::string, std::unique_ptr<Counters>>& Find(Shard& shard, std::string_view function);
+
+    uint64_t id;    // Tells thread-local caches apart across instances
+
+    // Shards outlive their threads; a new thread with a recycled ID takes
+    // over the old one's
+    std::mutex shardMutex;
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::unordered_map<std::thread::id, Shard*> shardsByThread;
+};
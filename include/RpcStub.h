@@ -0,0 +1,117 @@
+#pragma once
+
+// Encoding and decoding used by typed call stubs (RpcClient::Bind). Values
+// are written straight into the request payload in the negotiated format,
+// and binary results are read back without building a json tree.
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <stdexcept>
+
+#include <nlohmann/json.hpp>
+
+#include "RpcProtocol.h"
+
+
+class PayloadWriter
+{
+public:
+    explicit PayloadWriter(WireFormat format);
+
+    void BeginArgs(size_t count);
+    void Arg(std::string_view name, int64_t value);
+    void Arg(std::string_view name, uint64_t value);
+    void Arg(std::string_view name, double value);
+    void Arg(std::string_view name, bool value);
+    void Arg(std::string_view name, std::string_view value);
+    void Arg(std::string_view name, const nlohmann::json& value);
+
+    template <typename T>
+    void Arg(std::string_view name, const T& value)
+    {
+        if constexpr (std::is_same_v<T, bool>)
+            Arg(name, bool(value));
+        else if constexpr (std::is_floating_point_v<T>)
+            Arg(name, double(value));
+        else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+            Arg(name, int64_t(value));
+        else if constexpr (std::is_integral_v<T>)
+            Arg(name, uint64_t(value));
+        else if constexpr (std::is_convertible_v<const T&, std::string_view>)
+            Arg(name, std::string_view(value));
+        else
+            Arg(name, nlohmann::json(value));
+    }
+
+    // Closes the document and hands it over
+    std::string Finish();
+
+private:
+    void Key(std::string_view name);
+    void Head(int major, uint64_t argument);      // CBOR
+    void String(std::string_view value);
+    void BigEndian(uint64_t value, int size);
+
+    WireFormat format;
+    std::string payload;
+    std::string values;     // JSON: the "values" array, built beside "keys"
+    bool first;
+};
+
+// Reads {"result":...} from a MessagePack or CBOR response
+class PayloadReader
+{
+public:
+    PayloadReader(WireFormat format, const std::string& payload);
+
+    template <typename R>
+    R Result()
+    {
+        if constexpr (std::is_void_v<R>)
+        {
+            return;
+        }
+        else if constexpr (std::is_same_v<R, nlohmann::json>)
+        {
+            return Json();
+        }
+        else if constexpr (std::is_same_v<R, bool>)
+        {
+            return Bool();
+        }
+        else if constexpr (std::is_arithmetic_v<R>)
+        {
+            // Servers may send 3 as 3.0 and the other way round
+            double d;
+            int64_t i;
+            if (Number(d, i))
+                return static_cast<R>(i);
+            return static_cast<R>(d);
+        }
+        else if constexpr (std::is_same_v<R, std::string>)
+        {
+            return String();
+        }
+        else
+        {
+            return Json().template get<R>();
+        }
+    }
+
+private:
+    void Expect(bool condition);
+    uint8_t Byte();
+    uint64_t BigEndian(int size);
+    uint64_t Argument(uint8_t info);              // CBOR
+
+    bool Bool();
+    bool Number(double& d, int64_t& i);           // true if it was an integer
+    std::string String();
+    nlohmann::json Json();
+
+    WireFormat format;
+    const std::string& payload;
+    size_t offset;
+};
@@ -0,0 +1,257 @@
+#pragma once
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <WinSock2.h>
+#pragma comment(lib, "Ws2_32.lib")  // Optional backup
+#define SOCKET_TYPE SOCKET
+#else
+#define SOCKET_TYPE int
+#endif
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+#include "RpcProtocol.h"
+
+
+enum class TransportType
+{
+    TCP,            // Loopback TCP socket on the given port
+    SharedMemory,   // Shared-memory rings, attached over a TCP control socket
+    Unix,           // AF_UNIX stream socket at UnixSocketPath(port)
+    UringTCP,       // TCP driven through io_uring; plain TCP where unavailable
+    UringUnix       // Unix driven through io_uring; plain Unix where unavailable
+};
+
+struct TransportBuffer
+{
+    const void* data;
+    size_t size;
+};
+
+// Connection between the client and the server. RpcClient serializes Send
+// calls; ReceiveFrame is only called from the receiver thread. Wakeup may
+// be called from any thread and makes a blocked ReceiveFrame return false.
+class ITransport
+{
+public:
+    virtual ~ITransport() = default;
+
+    // Called once before anything else
+    virtual void Connect() = 0;
+
+    // Writes all buffers back to back as one message
+    virtual void Send(const TransportBuffer* buffers, size_t count) = 0;
+
+    // Blocks for the next header and its payload; false once woken or disconnected
+    virtual bool ReceiveFrame(ResponseHeader& header, std::string& payload) = 0;
+
+    virtual void Wakeup() = 0;
+
+    // Releases the connection; no other call may be in progress
+    virtual void Close() = 0;
+
+    // Whether SendWithFd works; file descriptors need an AF_UNIX socket
+    virtual bool CanSendFds() { return false; }
+
+    // Send, passing a duplicate of fd to the server along with the first byte
+    virtual void SendWithFd(const TransportBuffer* buffers, size_t count, int fd);
+};
+
+std::unique_ptr<ITransport> CreateTransport(TransportType type, int port);
+
+// Where servers listen for AF_UNIX clients of the given port
+std::string UnixSocketPath(int port);
+
+
+// Transports over a plain byte stream, framed by reading exact sizes
+class StreamTransport : public ITransport
+{
+public:
+    bool ReceiveFrame(ResponseHeader& header, std::string& payload) override;
+
+protected:
+    // Blocks until exactly size bytes arrived; false once woken or disconnected
+    virtual bool Recv(void* data, size_t size) = 0;
+};
+
+
+// Connected socket to the server, set up by the derived Connect
+class SocketTransport : public StreamTransport
+{
+public:
+    ~SocketTransport() override;
+
+    void Send(const TransportBuffer* buffers, size_t count) override;
+    void SendWithFd(const TransportBuffer* buffers, size_t count, int fd) override;
+    void Wakeup() override;
+    void Close() override;
+
+    // Non-blocking check for a hangup from the server
+    bool PeerClosed();
+
+protected:
+    SocketTransport();
+
+    // Send, with fd attached to the first write unless it is -1
+    void SendMessage(const TransportBuffer* buffers, size_t count, int fd);
+
+    bool Recv(void* data, size_t size) override;
+
+    SOCKET_TYPE clientSocket;
+    std::atomic_bool closed;
+
+    // Bytes read ahead of the frame being parsed
+    std::string receiveBuffer;
+    size_t receiveOffset;
+    size_t receiveSize;
+};
+
+class TcpTransport : public SocketTransport
+{
+public:
+    explicit TcpTransport(int port);
+
+    void Connect() override;
+
+private:
+    int port;
+};
+
+// Same-host transport without the TCP stack; access is governed by the
+// socket file's permissions
+class UnixTransport : public SocketTransport
+{
+public:
+    explicit UnixTransport(const std::string& path);
+
+    void Connect() override;
+    bool CanSendFds() override { return true; }
+
+private:
+    std::string path;
+};
+
+
+struct UringState;
+
+// Stream socket driven through io_uring instead of send/recv calls. Frames
+// sent while an earlier send is in flight are staged and go out together
+// in one SENDMSG; large frames go straight from the caller's buffers. A
+// multishot RECV into a ring of kernel-picked buffers keeps data arriving
+// without a syscall per read. Needs Linux 6.0 or later.
+class UringTransport : public StreamTransport
+{
+public:
+    explicit UringTransport(int port);                  // TCP
+    explicit UringTransport(const std::string& path);   // AF_UNIX stream
+    ~UringTransport() override;
+
+    // Whether this kernel and sandbox allow io_uring with buffer rings and
+    // multishot receive
+    static bool Supported();
+
+    void Connect() override;
+    void Send(const TransportBuffer* buffers, size_t count) override;
+    void Wakeup() override;
+    void Close() override;
+
+protected:
+    bool Recv(void* data, size_t size) override;
+
+private:
+    int port;
+    std::string path;
+    std::unique_ptr<UringState> state;
+};
+
+
+struct ShmSegment;
+struct ShmRingView;
+
+// Requests and responses travel through a pair of SPSC rings in a POSIX
+// shared-memory segment created by the client. The server is told about
+// the segment with _RPC::AttachSharedMemory over a TCP control socket,
+// which stays open to detect either side going away. Servers that don't
+// know the call leave the transport running over plain TCP.
+class ShmTransport : public StreamTransport
+{
+public:
+    explicit ShmTransport(int port);
+    ~ShmTransport() override;
+
+    void Connect() override;
+    void Send(const TransportBuffer* buffers, size_t count) override;
+    bool ReceiveFrame(ResponseHeader& header, std::string& payload) override;
+    void Wakeup() override;
+    void Close() override;
+
+protected:
+    bool Recv(void* data, size_t size) override;
+
+private:
+    bool Attach();
+
+    std::unique_ptr<TcpTransport> control;
+    std::function<bool()> peerAlive;
+
+    // Greeting read from the control socket before attaching
+    ResponseHeader hello;
+    bool helloPending;
+
+    std::string segmentName;
+    ShmSegment* segment;
+    size_t segmentSize;
+    std::unique_ptr<ShmRingView> requestRing;
+    std::unique_ptr<ShmRingView> responseRing;
+};
+
+
+// One direction of an in-process connection
+class LoopbackPipe
+{
+public:
+    void Write(const void* data, size_t size);
+
+    // Blocks until exactly size bytes arrived; false once closed
+    bool Read(void* data, size_t size);
+
+    void Close();
+
+private:
+    std::mutex mutex;
+    std::condition_variable readable;
+    std::string buffer;
+    size_t readOffset = 0;
+    bool closed = false;
+};
+
+// Client end of an in-process connection. A server running on another
+// thread reads requests from ToServer() and answers on ToClient(),
+// starting with the greeting header. Meant for tests and benchmarks.
+class LoopbackTransport : public StreamTransport
+{
+public:
+    LoopbackTransport();
+
+    std::shared_ptr<LoopbackPipe> ToServer() const { return toServer; }
+    std::shared_ptr<LoopbackPipe> ToClient() const { return toClient; }
+
+    void Connect() override;
+    void Send(const TransportBuffer* buffers, size_t count) override;
+    void Wakeup() override;
+    void Close() override;
+
+protected:
+    bool Recv(void* data, size_t size) override;
+
+private:
+    std::shared_ptr<LoopbackPipe> toServer;
+    std::shared_ptr<LoopbackPipe> toClient;
+};
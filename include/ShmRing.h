@@ -0,0 +1,254 @@
+#pragma once
+
+// Layout and ring operations for the shared-memory transport, used by both
+// ends of the connection. Each direction is a single-producer,
+// single-consumer byte ring; a side that finds its ring empty (or full)
+// sleeps on a futex word in the segment that the other side bumps.
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <functional>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+constexpr uint32_t SHM_MAGIC = 0x52504353;  // "SCPR"
+constexpr uint32_t SHM_VERSION = 1;
+constexpr uint32_t SHM_RING_CAPACITY = 1 << 20;
+constexpr int SHM_SPIN_COUNT = 256;
+constexpr int SHM_WAIT_TIMEOUT_MS = 100;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Ring indices must be address-free");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "Futex words must be address-free");
+
+struct ShmRing
+{
+    alignas(64) std::atomic<uint64_t> head;     // Total bytes written
+    std::atomic<uint32_t> spaceSeq;             // Bumped when the consumer frees space
+    std::atomic<uint32_t> producerWaiting;
+
+    alignas(64) std::atomic<uint64_t> tail;     // Total bytes read
+    std::atomic<uint32_t> dataSeq;              // Bumped when the producer adds data
+    std::atomic<uint32_t> consumerWaiting;
+
+    alignas(64) std::atomic<uint32_t> closed;
+    // Checked when attaching, then never read again; see ShmRingView
+    uint32_t capacity;                          // Power of two
+    uint64_t dataOffset;                        // From the start of the segment
+};
+
+struct ShmSegment
+{
+    uint32_t magic;
+    uint32_t version;
+    ShmRing requestRing;    // Client -> server
+    ShmRing responseRing;   // Server -> client
+};
+
+// One side's handle on a ring. The data pointer and capacity are kept
+// locally, so a peer rewriting its ShmRing can't move where we copy;
+// only the indices and wait words are read from the segment.
+struct ShmRingView
+{
+    ShmRing* ring = nullptr;
+    char* data = nullptr;
+    size_t capacity = 0;    // Power of two
+};
+
+// Views laid out as ShmInitSegment places the rings, from a capacity the
+// caller chose or checked, never from the segment itself
+inline ShmRingView ShmRequestView(ShmSegment* segment, uint32_t capacity)
+{
+    return { &segment->requestRing, reinterpret_cast<char*>(segment) + sizeof(ShmSegment), capacity };
+}
+
+inline ShmRingView ShmResponseView(ShmSegment* segment, uint32_t capacity)
+{
+    return { &segment->responseRing, reinterpret_cast<char*>(segment) + sizeof(ShmSegment) + capacity, capacity };
+}
+
+inline size_t ShmSegmentSize(uint32_t capacity)
+{
+    return sizeof(ShmSegment) + 2 * size_t(capacity);
+}
+
+inline void ShmInitSegment(ShmSegment* segment, uint32_t capacity)
+{
+    ShmRing* rings[] = { &segment->requestRing, &segment->responseRing };
+    for (int i = 0; i < 2; ++i)
+    {
+        ShmRing* ring = rings[i];
+        ring->head.store(0);
+        ring->spaceSeq.store(0);
+        ring->producerWaiting.store(0);
+        ring->tail.store(0);
+        ring->dataSeq.store(0);
+        ring->consumerWaiting.store(0);
+        ring->closed.store(0);
+        ring->capacity = capacity;
+        ring->dataOffset = sizeof(ShmSegment) + i * size_t(capacity);
+    }
+    segment->version = SHM_VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    segment->magic = SHM_MAGIC;
+}
+
+inline void ShmFutexWait(std::atomic<uint32_t>* word, uint32_t expected, int timeoutMs)
+{
+    timespec timeout = { timeoutMs / 1000, (timeoutMs % 1000) * 1000000L };
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+}
+
+inline void ShmFutexWake(std::atomic<uint32_t>* word)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+inline void ShmRingNotify(std::atomic<uint32_t>& seq, std::atomic<uint32_t>& waiting)
+{
+    // Pairs with the seq_cst store of the waiting flag in ShmRingWait: either
+    // the waiter sees our index update, or we see it waiting and wake it.
+    if (waiting.load(std::memory_order_seq_cst))
+    {
+        seq.fetch_add(1, std::memory_order_release);
+        ShmFutexWake(&seq);
+    }
+}
+
+// Waits until ready() holds. Returns false if the ring is closed or
+// peerAlive reports the other side gone.
+template <typename Ready>
+inline bool ShmRingWait(
+    ShmRing& ring,
+    std::atomic<uint32_t>& seq,
+    std::atomic<uint32_t>& waiting,
+    Ready ready,
+    const std::function<bool()>& peerAlive)
+{
+    for (int i = 0; i < SHM_SPIN_COUNT; ++i)
+    {
+        if (ready())
+            return true;
+    }
+
+    while (true)
+    {
+        uint32_t observed = seq.load(std::memory_order_acquire);
+        waiting.store(1, std::memory_order_seq_cst);
+
+        if (ready())
+        {
+            waiting.store(0, std::memory_order_relaxed);
+            return true;
+        }
+        if (ring.closed.load(std::memory_order_acquire))
+        {
+            waiting.store(0, std::memory_order_relaxed);
+            return false;
+        }
+
+        ShmFutexWait(&seq, observed, SHM_WAIT_TIMEOUT_MS);
+        waiting.store(0, std::memory_order_relaxed);
+
+        if (peerAlive && !ready() && !peerAlive())
+            return false;
+    }
+}
+
+inline bool ShmRingWrite(
+    const ShmRingView& view,
+    const void* data,
+    size_t size,
+    const std::function<bool()>& peerAlive = {})
+{
+    ShmRing& ring = *view.ring;
+    char* buffer = view.data;
+    const char* src = static_cast<const char*>(data);
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+
+    while (size > 0)
+    {
+        if (ring.closed.load(std::memory_order_acquire))
+            return false;
+
+        uint64_t tail = ring.tail.load(std::memory_order_acquire);
+        size_t space = view.capacity - size_t(head - tail);
+        if (space == 0)
+        {
+            bool hasSpace = ShmRingWait(ring, ring.spaceSeq, ring.producerWaiting, [&]()
+            {
+                return ring.tail.load(std::memory_order_seq_cst) != tail;
+            }, peerAlive);
+
+            if (!hasSpace)
+                return false;
+            continue;
+        }
+
+        size_t offset = head & (view.capacity - 1);
+        size_t chunk = std::min({ size, space, view.capacity - offset });
+        memcpy(buffer + offset, src, chunk);
+
+        head += chunk;
+        src += chunk;
+        size -= chunk;
+        ring.head.store(head, std::memory_order_seq_cst);
+        ShmRingNotify(ring.dataSeq, ring.consumerWaiting);
+    }
+    return true;
+}
+
+inline bool ShmRingRead(
+    const ShmRingView& view,
+    void* data,
+    size_t size,
+    const std::function<bool()>& peerAlive = {})
+{
+    ShmRing& ring = *view.ring;
+    const char* buffer = view.data;
+    char* dst = static_cast<char*>(data);
+    uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+
+    while (size > 0)
+    {
+        uint64_t head = ring.head.load(std::memory_order_acquire);
+        size_t available = size_t(head - tail);
+        if (available == 0)
+        {
+            bool hasData = ShmRingWait(ring, ring.dataSeq, ring.consumerWaiting, [&]()
+            {
+                return ring.head.load(std::memory_order_seq_cst) != tail;
+            }, peerAlive);
+
+            if (!hasData)
+                return false;
+            continue;
+        }
+
+        size_t offset = tail & (view.capacity - 1);
+        size_t chunk = std::min({ size, available, view.capacity - offset });
+        memcpy(dst, buffer + offset, chunk);
+
+        tail += chunk;
+        dst += chunk;
+        size -= chunk;
+        ring.tail.store(tail, std::memory_order_seq_cst);
+        ShmRingNotify(ring.spaceSeq, ring.producerWaiting);
+    }
+    return true;
+}
+
+inline void ShmRingClose(ShmRing& ring)
+{
+    ring.closed.store(1, std::memory_order_seq_cst);
+    ring.dataSeq.fetch_add(1, std::memory_order_release);
+    ring.spaceSeq.fetch_add(1, std::memory_order_release);
+    ShmFutexWake(&ring.dataSeq);
+    ShmFutexWake(&ring.spaceSeq);
+}
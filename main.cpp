@@ -9,7 +9,7 @@
 #endif
 
 int main() {
-    RpcClient rpcClient{};
+    RpcClient& rpcClient = RpcClient::Get();
 
     nlohmann::json result;
 
@@ -30,6 +30,11 @@ int main() {
     });
     std::cout << "[C++] echo Response: " << result << std::endl;
 
+    auto subFuture = rpcClient.CallAsync("sub", {{"a", 10}, {"b", 4}});
+    auto mulFuture = rpcClient.CallAsync("mul", {{"a", 3}, {"b", 7}});
+    std::cout << "[C++] async sub Response: " << subFuture.get() << std::endl;
+    std::cout << "[C++] async mul Response: " << mulFuture.get() << std::endl;
+
     result = rpcClient.Call("do_work",
     {
         {"input", "Hello from C++"},
@@ -49,7 +54,7 @@ int main() {
     },
     {
         {"callback", [&](const nlohmann::json& result) {
-            rpcClient.Call("AddToCounter", {{"value", 1}});
+            rpcClient.Notify("AddToCounter", {{"value", 1}});
             std::cout << "[Callback] Received result from Unity: " << result.dump() << std::endl;
         }}
     });
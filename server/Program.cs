@@ -17,7 +17,7 @@ class Program
         server.Register("mul", mul);
         server.Register("echo", (string text) => "Server echo: " + text);
 
-        server.Register("do_work", (string input, int delay, int onComplete) =>
+        server.Register("do_work", (string input, int delay, long onComplete) =>
         {
             Console.WriteLine("input: " + input);
             Console.WriteLine("Delay: " + delay);
@@ -25,7 +25,7 @@ class Program
             server.TriggerCallback(onComplete, new { a = 1, b = "str", c = 3.33 });
         });
 
-        server.Register("timer", (int interval, int callback, int text) =>
+        server.Register("timer", (int interval, long callback, int text) =>
         {
             return server.handleRegistry.AddHandle(new Timer(
                 callback: state => server.TriggerCallback(callback, new { text }),
@@ -47,6 +47,10 @@ class Program
             return false;
         });
 
-        while (true) ;
+        while (true)
+        {
+            server.WaitForWork();
+            server.ProcessRPC();
+        }
     }
 }
\ No newline at end of file
@@ -0,0 +1,240 @@
+using System;
+using System.Collections;
+using System.Collections.Generic;
+using System.Globalization;
+using System.IO;
+using System.Text;
+
+namespace Serialization
+{
+    // Minimal CBOR (RFC 8949) codec for the binary wire format: integers,
+    // floats, strings, byte strings, arrays, maps, booleans and null.
+    // Decoded integers are long, floats double, arrays List<object?> and
+    // maps Dictionary<string, object?>.
+    public static class Cbor
+    {
+        public static byte[] Encode(object? value)
+        {
+            var stream = new MemoryStream();
+            Write(stream, value);
+            return stream.ToArray();
+        }
+
+        public static object? Decode(byte[] data)
+        {
+            int offset = 0;
+            object? value = Read(data, ref offset);
+            if (offset != data.Length)
+                throw new FormatException("Trailing bytes after CBOR value");
+            return value;
+        }
+
+        private static void Write(MemoryStream stream, object? value)
+        {
+            switch (value)
+            {
+                case null:
+                    stream.WriteByte(0xf6);
+                    break;
+                case bool b:
+                    stream.WriteByte(b ? (byte)0xf5 : (byte)0xf4);
+                    break;
+                case string s:
+                    byte[] text = Encoding.UTF8.GetBytes(s);
+                    WriteHead(stream, 3, (ulong)text.Length);
+                    stream.Write(text, 0, text.Length);
+                    break;
+                case byte[] bytes:
+                    WriteHead(stream, 2, (ulong)bytes.Length);
+                    stream.Write(bytes, 0, bytes.Length);
+                    break;
+                case float f:
+                    // Widen through the shortest round-trip text so 46.4f stays 46.4
+                    WriteDouble(stream, double.Parse(f.ToString("R", CultureInfo.InvariantCulture), CultureInfo.InvariantCulture));
+                    break;
+                case double d:
+                    WriteDouble(stream, d);
+                    break;
+                case decimal m:
+                    WriteDouble(stream, (double)m);
+                    break;
+                case ulong u:
+                    WriteHead(stream, 0, u);
+                    break;
+                case sbyte or byte or short or ushort or int or uint or long:
+                    long l = Convert.ToInt64(value);
+                    if (l >= 0)
+                        WriteHead(stream, 0, (ulong)l);
+                    else
+                        WriteHead(stream, 1, (ulong)(-1 - l));
+                    break;
+                case IDictionary map:
+                    WriteHead(stream, 5, (ulong)map.Count);
+                    foreach (DictionaryEntry entry in map)
+                    {
+                        Write(stream, entry.Key.ToString());
+                        Write(stream, entry.Value);
+                    }
+                    break;
+                case IList list:
+                    WriteHead(stream, 4, (ulong)list.Count);
+                    foreach (object? item in list)
+                        Write(stream, item);
+                    break;
+                default:
+                    Write(stream, value.ToString());
+                    break;
+            }
+        }
+
+        private static void WriteHead(MemoryStream stream, int major, ulong argument)
+        {
+            int type = major << 5;
+            if (argument < 24)
+            {
+                stream.WriteByte((byte)(type | (int)argument));
+            }
+            else if (argument <= byte.MaxValue)
+            {
+                stream.WriteByte((byte)(type | 24));
+                stream.WriteByte((byte)argument);
+            }
+            else if (argument <= ushort.MaxValue)
+            {
+                stream.WriteByte((byte)(type | 25));
+                WriteBigEndian(stream, argument, 2);
+            }
+            else if (argument <= uint.MaxValue)
+            {
+                stream.WriteByte((byte)(type | 26));
+                WriteBigEndian(stream, argument, 4);
+            }
+            else
+            {
+                stream.WriteByte((byte)(type | 27));
+                WriteBigEndian(stream, argument, 8);
+            }
+        }
+
+        private static void WriteDouble(MemoryStream stream, double d)
+        {
+            stream.WriteByte(0xfb);
+            WriteBigEndian(stream, (ulong)BitConverter.DoubleToInt64Bits(d), 8);
+        }
+
+        private static void WriteBigEndian(MemoryStream stream, ulong value, int size)
+        {
+            for (int shift = (size - 1) * 8; shift >= 0; shift -= 8)
+                stream.WriteByte((byte)(value >> shift));
+        }
+
+        private static object? Read(byte[] data, ref int offset)
+        {
+            if (offset >= data.Length)
+                throw new FormatException("Truncated CBOR value");
+
+            byte initial = data[offset++];
+            int major = initial >> 5;
+            int info = initial & 0x1f;
+
+            if (major == 7)
+            {
+                switch (info)
+                {
+                    case 20: return false;
+                    case 21: return true;
+                    case 22: return null;
+                    case 23: return null;
+                    case 25: return HalfToDouble((int)ReadBigEndian(data, ref offset, 2));
+                    case 26: return (double)BitConverter.Int32BitsToSingle((int)ReadBigEndian(data, ref offset, 4));
+                    case 27: return BitConverter.Int64BitsToDouble((long)ReadBigEndian(data, ref offset, 8));
+                    default: throw new FormatException($"Unsupported CBOR simple value {info}");
+                }
+            }
+
+            ulong argument = ReadArgument(data, ref offset, info);
+            if ((major == 2 || major == 3) && argument > (ulong)(data.Length - offset))
+                throw new FormatException("Truncated CBOR value");
+
+            switch (major)
+            {
+                case 0:
+                    return (long)argument;
+                case 1:
+                    return -1 - (long)argument;
+                case 2:
+                {
+                    byte[] bytes = new byte[argument];
+                    Array.Copy(data, offset, bytes, 0, (int)argument);
+                    offset += (int)argument;
+                    return bytes;
+                }
+                case 3:
+                {
+                    string text = Encoding.UTF8.GetString(data, offset, (int)argument);
+                    offset += (int)argument;
+                    return text;
+                }
+                case 4:
+                {
+                    var list = new List<object?>();
+                    for (ulong i = 0; i < argument; i++)
+                        list.Add(Read(data, ref offset));
+                    return list;
+                }
+                case 5:
+                {
+                    var map = new Dictionary<string, object?>();
+                    for (ulong i = 0; i < argument; i++)
+                    {
+                        string key = Read(data, ref offset)?.ToString() ?? "";
+                        map[key] = Read(data, ref offset);
+                    }
+                    return map;
+                }
+                default:
+                    // Tags carry no meaning here; decode the tagged value
+                    return Read(data, ref offset);
+            }
+        }
+
+        private static double HalfToDouble(int half)
+        {
+            int exponent = (half >> 10) & 0x1f;
+            int mantissa = half & 0x3ff;
+            double value;
+            if (exponent == 0)
+                value = mantissa * Math.Pow(2, -24);
+            else if (exponent != 31)
+                value = (mantissa + 1024) * Math.Pow(2, exponent - 25);
+            else
+                value = mantissa == 0 ? double.PositiveInfinity : double.NaN;
+            return (half & 0x8000) != 0 ? -value : value;
+        }
+
+        private static ulong ReadArgument(byte[] data, ref int offset, int info)
+        {
+            if (info < 24)
+                return (ulong)info;
+            switch (info)
+            {
+                case 24: return ReadBigEndian(data, ref offset, 1);
+                case 25: return ReadBigEndian(data, ref offset, 2);
+                case 26: return ReadBigEndian(data, ref offset, 4);
+                case 27: return ReadBigEndian(data, ref offset, 8);
+                default: throw new FormatException("Indefinite-length CBOR is not supported");
+            }
+        }
+
+        private static ulong ReadBigEndian(byte[] data, ref int offset, int size)
+        {
+            if (offset + size > data.Length)
+                throw new FormatException("Truncated CBOR value");
+
+            ulong value = 0;
+            for (int i = 0; i < size; i++)
+                value = (value << 8) | data[offset++];
+            return value;
+        }
+    }
+}
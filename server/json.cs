@@ -18,6 +18,9 @@ namespace Serialization
     {
         public string[] keys;
         public string[] values;
+
+        // Callback IDs allocated by the client for this call
+        public long[]? callbacks;
     }
 
     [Serializable]
@@ -51,6 +54,49 @@ namespace Serialization
 #endif
         }
 
+#if !UNITY_2017_1_OR_NEWER
+        // Native JSON wire format: values are embedded as themselves rather
+        // than as dumped strings. Decoded integers are long, other numbers
+        // double, arrays List<object?> and objects Dictionary<string, object?>.
+        static public string ToNativeJson(object? value)
+        {
+            return JsonSerializer.Serialize(value);
+        }
+
+        static public object? FromNativeJson(string jsonString)
+        {
+            using JsonDocument document = JsonDocument.Parse(jsonString);
+            return ToObject(document.RootElement);
+        }
+
+        static private object? ToObject(JsonElement element)
+        {
+            switch (element.ValueKind)
+            {
+                case JsonValueKind.String:
+                    return element.GetString();
+                case JsonValueKind.Number:
+                    return element.TryGetInt64(out long l) ? l : element.GetDouble();
+                case JsonValueKind.True:
+                    return true;
+                case JsonValueKind.False:
+                    return false;
+                case JsonValueKind.Array:
+                    var list = new List<object?>();
+                    foreach (JsonElement item in element.EnumerateArray())
+                        list.Add(ToObject(item));
+                    return list;
+                case JsonValueKind.Object:
+                    var map = new Dictionary<string, object?>();
+                    foreach (JsonProperty property in element.EnumerateObject())
+                        map[property.Name] = ToObject(property.Value);
+                    return map;
+                default:
+                    return null;
+            }
+        }
+#endif
+
         static public RpcArgsWrapper? FromJson(string jsonString)
         {
 #if UNITY_2017_1_OR_NEWER
@@ -20,11 +20,26 @@ namespace SharedMemRPC
     [StructLayout(LayoutKind.Sequential, CharSet = CharSet.Ansi, Pack = 1)]
     public struct RpcRequest
     {
-        public int request_id;
+        public int clientId;
+        public int requestId;
 
-        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 64)]
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 63)]
         public string functionName;
 
+        public byte flags;
+        public int bufferSize;
+    }
+
+    // Replaces RpcRequest once compact headers are on; see
+    // SwitchesToCompact. Method 0 is unresolved: nameLength bytes of the
+    // name follow, and the response carries the method ID to use from then on.
+    [StructLayout(LayoutKind.Sequential, Pack = 1)]
+    public struct CompactRequest
+    {
+        public int requestId;
+        public ushort methodId;
+        public byte flags;
+        public byte nameLength;
         public int bufferSize;
     }
 
@@ -36,11 +51,43 @@ namespace SharedMemRPC
         //     RETURN = 1
         // };
         public int clientId;
-        public int msgType;
+        public int requestId;
+        public byte msgType;
+        public byte flags;
+        public ushort methodId;     // Answer to an unresolved compact request
         public int statusCodeOrCallbackId;
         public int bufferSize;
     }
 
+    public static class RequestFlags
+    {
+        // No response is sent; such requests carry request ID 0
+        public const byte Oneway = 0x04;
+    }
+
+    public static class WireFormat
+    {
+        // Payload encoding in the low bits of the header flags. Requests are
+        // answered in the format they arrive in.
+        public const byte Json = 0;
+        public const byte MessagePack = 1;  // Not supported by this server
+        public const byte Cbor = 2;
+        public const byte NativeJson = 3;   // Not under Unity
+        public const byte Mask = 0x03;
+
+        // Names used by _RPC::Negotiate, indexed by format
+        public static readonly string[] Names = { "json", "msgpack", "cbor", "json-native" };
+
+        public static bool IsSupported(byte format)
+        {
+#if UNITY_2017_1_OR_NEWER
+            return format == Json || format == Cbor;
+#else
+            return format == Json || format == Cbor || format == NativeJson;
+#endif
+        }
+    }
+
     public class HandleRegistry
     {
         private readonly Dictionary<int, object> handles = new();
@@ -68,41 +115,143 @@ namespace SharedMemRPC
 
     public class RpcServer
     {
-        private readonly Dictionary<string, Func<Dictionary<string, string>, object>> functions = new();
-        private readonly Dictionary<int, TcpClient> clients = new();
-        private readonly Dictionary<int, int> callbackToClientId = new();
+        private const ushort BatchMethodId = 1;
+
+        // Connection features granted by _RPC::Negotiate. Memfd payloads and
+        // blob sections aren't read here, so clients keep them off.
+        private const string CompactHeadersFeature = "compact-headers";
+        private static readonly string[] SupportedFeatures = { CompactHeadersFeature, "batch" };
+
+        // Functions by method ID; ID 0 stands for unresolved
+        private readonly List<Func<Dictionary<string, object?>, object?>?> methods = new() { null };
+        private readonly Dictionary<string, ushort> methodIds = new();
+        private readonly Dictionary<int, NetworkStream> clients = new();
+        private readonly Dictionary<long, int> callbackToClientId = new();
+        private readonly Dictionary<int, byte> clientFormats = new();
         private readonly List<Thread> threads = new();
         private readonly ConcurrentQueue<Action> mainThreadQueue = new();
 
         private int nextCallbackId = 0;
+
+        // Client whose request is being dispatched; handlers all run on the main thread
+        private int dispatchingClientId;
         private readonly Mutex respMutex = new();
         private readonly Mutex queueMutex = new();
+        private readonly AutoResetEvent workAvailable = new(false);
 
         private readonly TcpListener listener;
+        private readonly Socket? unixListener;
 
         public HandleRegistry handleRegistry;
 
-        public RpcServer(int port = 6969)
+        // Clients on the same host can also connect over an AF_UNIX stream socket at
+        // unixSocketPath (default /tmp/SharedMemRPC.<port>.sock on Unix-like systems).
+        public RpcServer(int port = 6969, string? unixSocketPath = null)
         {
             handleRegistry = new HandleRegistry();
+
+            // Runs a list of calls back to back; handled by Dispatch itself
+            methodIds["_RPC::Batch"] = BatchMethodId;
+            methods.Add(null);
+
+            // For clients that don't allocate callback IDs themselves
             Register<Func<int, int>>("_RPC::AllocateCallback", (int clientId) =>
             {
+                respMutex.WaitOne();
                 callbackToClientId[nextCallbackId] = clientId;
+                respMutex.ReleaseMutex();
                 return nextCallbackId++;
             });
 
+            // Requests after this one use CompactRequest; see HandleClient.
+            // Kept for clients that predate features in _RPC::Negotiate.
+            Register<Func<int>>("_RPC::EnableCompactHeaders", () => 1);
+
+            Register<Func<string, string, string>>("_RPC::Negotiate", Negotiate);
+
             listener = new TcpListener(IPAddress.Any, port);
             listener.Start();
             listener.BeginAcceptTcpClient(OnClientConnected, null);
+
+            unixSocketPath ??= DefaultUnixSocketPath(port);
+            if (unixSocketPath != null)
+            {
+                File.Delete(unixSocketPath);
+                unixListener = new Socket(AddressFamily.Unix, SocketType.Stream, ProtocolType.Unspecified);
+                unixListener.Bind(new UnixDomainSocketEndPoint(unixSocketPath));
+                unixListener.Listen();
+                unixListener.BeginAccept(OnUnixClientConnected, null);
+            }
             DebugPrint("Server started...");
         }
 
+        // Clients offer formats as a JSON array in order of preference. The
+        // format is set for the connection asking, whatever it claims to be.
+        // Features asked for alongside are granted in the same reply; compact
+        // headers were already switched on as the request was read.
+        private string Negotiate(string formats, string? features = null)
+        {
+            byte chosen = WireFormat.Json;
+            int chosenAt = int.MaxValue;
+            for (byte format = 0; format < WireFormat.Names.Length; format++)
+            {
+                int at = formats.IndexOf($"\"{WireFormat.Names[format]}\"");
+                if (at >= 0 && at < chosenAt && WireFormat.IsSupported(format))
+                {
+                    chosen = format;
+                    chosenAt = at;
+                }
+            }
+
+            respMutex.WaitOne();
+            clientFormats[dispatchingClientId] = chosen;
+            respMutex.ReleaseMutex();
+
+            if (features == null)
+                return WireFormat.Names[chosen];
+
+            var granted = new List<string>();
+            foreach (string feature in SupportedFeatures)
+            {
+                if (Lists(features, feature))
+                    granted.Add($"\"{feature}\"");
+            }
+            return $"{{\"format\":\"{WireFormat.Names[chosen]}\",\"features\":[{string.Join(",", granted)}]}}";
+        }
+
+        // Whether a request read with a full header turns on CompactRequest
+        // for the requests behind it
+        private bool SwitchesToCompact(string functionName, byte[] payload)
+        {
+            if (functionName == "_RPC::EnableCompactHeaders")
+                return true;
+            if (functionName != "_RPC::Negotiate")
+                return false;
+
+            // Parsed again when it runs; that happens once per connection
+            try
+            {
+                var args = ParseArgs(JsonHelper.FromJson(Encoding.UTF8.GetString(payload)));
+                return args.TryGetValue("features", out object? features) && Lists(features as string, CompactHeadersFeature);
+            }
+            catch (Exception)
+            {
+                return false;
+            }
+        }
+
+        // Whether a JSON array of names, as it arrives, holds name
+        private static bool Lists(string? names, string name)
+        {
+            return names != null && names.Contains($"\"{name}\"");
+        }
+
         public void Register<TDelegate>(string name, TDelegate del) where TDelegate : Delegate
         {
             var method = del.Method;
             var target = del.Target;
 
-            functions[name] = (argDict) =>
+            Func<Dictionary<string, object?>, object?> invoker = (argDict) =>
             {
                 var parameters = method.GetParameters();
                 var args = new object[parameters.Length];
@@ -110,15 +259,30 @@ namespace SharedMemRPC
                 for (int i = 0; i < parameters.Length; i++)
                 {
                     var param = parameters[i];
-                    if (!argDict.TryGetValue(param.Name, out var strValue))
-                        throw new ArgumentException($"Missing argument: {param.Name}");
-
-                    args[i] = Convert.ChangeType(strValue, param.ParameterType);
+                    if (!argDict.TryGetValue(param.Name, out var value))
+                    {
+                        if (!param.HasDefaultValue)
+                            throw new ArgumentException($"Missing argument: {param.Name}");
+                        args[i] = param.DefaultValue;
+                        continue;
+                    }
+
+                    // JSON arguments arrive as strings, binary ones as numbers, strings, lists or maps
+                    args[i] = Convert.ChangeType(value, param.ParameterType);
                 }
 
-                object? result = method.Invoke(target, args);
-                return result?.ToString() ?? "";
+                return method.Invoke(target, args);
             };
+
+            if (methodIds.TryGetValue(name, out ushort methodId))
+            {
+                methods[methodId] = invoker;
+            }
+            else
+            {
+                methodIds[name] = (ushort)methods.Count;
+                methods.Add(invoker);
+            }
         }
 
         public void ProcessRPC()
@@ -140,10 +304,18 @@ namespace SharedMemRPC
             queueMutex.ReleaseMutex();
         }
 
+        // Blocks until RunOnMainThread queues work, so hosts without a frame
+        // loop can pump ProcessRPC without spinning.
+        public bool WaitForWork(int millisecondsTimeout = Timeout.Infinite)
+        {
+            return workAvailable.WaitOne(millisecondsTimeout);
+        }
+
         private void OnClientConnected(IAsyncResult ar)
         {
             TcpClient client = listener.EndAcceptTcpClient(ar);
-            var thread = new Thread(() => HandleClient(client));
+            client.NoDelay = true;
+            var thread = new Thread(() => HandleClient(client.Client));
             threads.Add(thread);
             thread.Start();
 
@@ -151,6 +323,24 @@ namespace SharedMemRPC
             listener.BeginAcceptTcpClient(OnClientConnected, null);
         }
 
+        private void OnUnixClientConnected(IAsyncResult ar)
+        {
+            Socket socket = unixListener!.EndAccept(ar);
+            var thread = new Thread(() => HandleClient(socket));
+            threads.Add(thread);
+            thread.Start();
+
+            unixListener.BeginAccept(OnUnixClientConnected, null);
+        }
+
+        private static string? DefaultUnixSocketPath(int port)
+        {
+            PlatformID platform = Environment.OSVersion.Platform;
+            if (platform != PlatformID.Unix && platform != PlatformID.MacOSX)
+                return null;
+            return $"/tmp/SharedMemRPC.{port}.sock";
+        }
+
         private void OnClientDisconnected(int clientId)
         {
             DebugPrint($"[RPC Service {clientId}] Disconnected callback triggered.");
@@ -169,55 +359,98 @@ namespace SharedMemRPC
             queueMutex.WaitOne();
             mainThreadQueue.Enqueue(action);
             queueMutex.ReleaseMutex();
+            workAvailable.Set();
         }
 
-        private void HandleClient(TcpClient client)
+        private void HandleClient(Socket socket)
         {
+            NetworkStream networkStream = new NetworkStream(socket, ownsSocket: true);
             try
             {
                 respMutex.WaitOne();
-                clients[Environment.CurrentManagedThreadId] = client;
+                clients[Environment.CurrentManagedThreadId] = networkStream;
                 respMutex.ReleaseMutex();
-                client.NoDelay = true;
                 DebugPrint("Client connected.");
 
-                NetworkStream networkStream = client.GetStream();
                 WriteHeader(networkStream, new ResponseHeader
                 {
                     clientId = Environment.CurrentManagedThreadId,
+                    requestId = 0,
                     msgType = 1,
                     statusCodeOrCallbackId = 0,
                     bufferSize = 0
                 });
 
+                bool compact = false;
                 while (true)
                 {
                     DebugPrint($"[RPC Service {Environment.CurrentManagedThreadId}] Waiting for request...");
-                    var req = ReadHeader<RpcRequest>(networkStream);
-                    string argsJson = ReadPayload(networkStream, req.bufferSize);
+                    RpcRequest req;
+                    ushort methodId;
+                    ushort resolvedId = 0;
+                    if (compact)
+                    {
+                        var header = ReadHeader<CompactRequest>(networkStream);
+                        req = new RpcRequest
+                        {
+                            requestId = header.requestId,
+                            flags = header.flags,
+                            bufferSize = header.bufferSize
+                        };
+
+                        methodId = header.methodId;
+                        if (methodId == 0)
+                        {
+                            req.functionName = Encoding.UTF8.GetString(ReadPayload(networkStream, header.nameLength));
+                            methodIds.TryGetValue(req.functionName, out methodId);
+                            resolvedId = methodId;
+                        }
+                        else
+                        {
+                            req.functionName = $"#{methodId}";
+                        }
+                    }
+                    else
+                    {
+                        req = ReadHeader<RpcRequest>(networkStream);
+                        methodIds.TryGetValue(req.functionName, out methodId);
+                    }
+
+                    byte[] payload = ReadPayload(networkStream, req.bufferSize);
+
+                    // The reply is still a plain ResponseHeader
+                    if (!compact)
+                        compact = SwitchesToCompact(req.functionName, payload);
+
                     int clientId = Environment.CurrentManagedThreadId;
 
                     RunOnMainThread(() =>
                     {
-                        string result = Dispatch(clientId, req.functionName, argsJson, out int status);
+                        byte format = (byte)(req.flags & WireFormat.Mask);
+                        byte[] result = Dispatch(clientId, methodId, req.functionName, payload, format, out int status);
 
                         var resp = new ResponseHeader
                         {
                             clientId = clientId,
+                            requestId = req.requestId,
                             msgType = 1,
+                            flags = format,
+                            methodId = resolvedId,
                             statusCodeOrCallbackId = status,
                             bufferSize = result.Length
                         };
 
                         respMutex.WaitOne();
-                        if (clients.TryGetValue(clientId, out TcpClient tcpClient) && tcpClient.Connected)
+                        bool oneway = (req.flags & RequestFlags.Oneway) != 0;
+                        if (!oneway && clients.TryGetValue(clientId, out NetworkStream stream) && stream.Socket.Connected)
                         {
-                            WriteHeader(tcpClient.GetStream(), resp);
-                            WritePayload(tcpClient.GetStream(), result);
+                            WriteHeader(stream, resp);
+                            WritePayload(stream, result);
                         }
                         respMutex.ReleaseMutex();
 
-                        DebugPrint($"[RPC Service {clientId}] Handled: {req.functionName}, Response: {result}");
+                        string shown = format == WireFormat.Json ? Encoding.UTF8.GetString(result) : $"{result.Length} bytes";
+                        DebugPrint($"[RPC Service {clientId}] Handled: {req.functionName}, Response: {shown}");
                     });
                 }
             }
@@ -225,7 +458,8 @@ namespace SharedMemRPC
             {
                 respMutex.WaitOne();
                 clients.Remove(Environment.CurrentManagedThreadId);
-                client.Close();
+                clientFormats.Remove(Environment.CurrentManagedThreadId);
+                networkStream.Close();
                 respMutex.ReleaseMutex();
                 
                 DebugPrint($"[RPC Service {Environment.CurrentManagedThreadId}] Client disconnected.");
@@ -244,9 +478,49 @@ namespace SharedMemRPC
             // }
         }
 
-        public void TriggerCallback(int callbackId, object namedArgs)
+        public void TriggerCallback(long callbackId, object namedArgs)
+        {
+            respMutex.WaitOne();
+            if (!callbackToClientId.TryGetValue(callbackId, out int clientId))
+            {
+                respMutex.ReleaseMutex();
+                throw new ArgumentException($"Unknown callback: {callbackId}");
+            }
+            clientFormats.TryGetValue(clientId, out byte format);
+
+            byte[] payload = EncodeCallbackArgs(format, namedArgs);
+
+            // The client rebuilds the full ID from the header's clientId
+            var cb = new ResponseHeader
+            {
+                clientId = clientId,
+                requestId = 0,
+                msgType = 0,
+                flags = format,
+                statusCodeOrCallbackId = unchecked((int)callbackId),
+                bufferSize = payload.Length
+            };
+
+            if (clients.TryGetValue(cb.clientId, out NetworkStream stream) && stream.Socket.Connected)
+            {
+                WriteHeader(stream, cb);
+                WritePayload(stream, payload);
+            }
+            respMutex.ReleaseMutex();
+        }
+
+        private static byte[] EncodeCallbackArgs(byte format, object namedArgs)
         {
             var props = namedArgs.GetType().GetProperties();
+
+            if (format == WireFormat.Cbor || format == WireFormat.NativeJson)
+            {
+                var args = new Dictionary<string, object?>();
+                foreach (var prop in props)
+                    args[prop.Name] = prop.GetValue(namedArgs);
+                return EncodeDocument(format, args);
+            }
+
             var keys = new List<string>();
             var values = new List<string>();
 
@@ -263,33 +537,36 @@ namespace SharedMemRPC
                 values = values.ToArray()
             };
 
-            string json = JsonHelper.ToJson(wrapper);
-
-            var cb = new ResponseHeader
-            {
-                clientId = callbackToClientId[callbackId],
-                msgType = 0,
-                statusCodeOrCallbackId = callbackId,
-                bufferSize = json.Length
-            };
-
-            respMutex.WaitOne();
-            if (clients.TryGetValue(cb.clientId, out TcpClient tcpClient) && tcpClient.Connected)
-            {
-                WriteHeader(tcpClient.GetStream(), cb);
-                WritePayload(tcpClient.GetStream(), json);
-            }
-            respMutex.ReleaseMutex();
+            return Encoding.UTF8.GetBytes(JsonHelper.ToJson(wrapper));
         }
 
-        private string Dispatch(int clientId, string func, string argsJson, out int status)
+        private byte[] Dispatch(int clientId, ushort methodId, string func, byte[] payload, byte format, out int status)
         {
+            dispatchingClientId = clientId;
             try
             {
-                Dictionary<string, string> args = ParseArgs(argsJson);
-                var result = functions[func](args);
+                if (methodId == BatchMethodId)
+                {
+                    List<object?> results = DispatchBatch(clientId, format, payload);
+                    status = 0;
+                    return EncodeResult(format, results);
+                }
+
+                Dictionary<string, object?> args;
+                if (format == WireFormat.Cbor || format == WireFormat.NativeJson)
+                {
+                    args = ParseDocumentArgs(clientId, DecodeDocument(format, payload));
+                }
+                else
+                {
+                    RpcArgsWrapper? parsed = JsonHelper.FromJson(Encoding.UTF8.GetString(payload));
+                    RegisterCallbacks(clientId, parsed?.callbacks);
+                    args = ParseArgs(parsed);
+                }
+
+                object? result = FindMethod(methodId, func)(args);
                 status = 0;
-                return JsonHelper.ToJson(result?.ToString());
+                return EncodeResult(format, result);
             }
             catch (Exception ex)
             {
@@ -298,15 +575,111 @@ namespace SharedMemRPC
                     ex.Message + "\n" + ex.StackTrace
                 );
                 status = 1;
-                return JsonHelper.ToJson(ex.Message);
+                return EncodeResult(format, ex.Message);
+            }
+        }
+
+        private Func<Dictionary<string, object?>, object?> FindMethod(ushort methodId, string func)
+        {
+            var function = methodId < methods.Count ? methods[methodId] : null;
+            if (function == null)
+                throw new KeyNotFoundException($"The given key '{func}' was not present in the dictionary.");
+            return function;
+        }
+
+        // {"calls":[{"function":...,"args":{...},"callbacks":[...]}]}, answered
+        // with [{"status":...,"result":...}]. Entries fail independently.
+        private List<object?> DispatchBatch(int clientId, byte format, byte[] payload)
+        {
+            if (format != WireFormat.Cbor && format != WireFormat.NativeJson)
+                throw new ArgumentException("Batches need a negotiated wire format");
+
+            if (DecodeDocument(format, payload) is not Dictionary<string, object?> document ||
+                !document.TryGetValue("calls", out object? calls) || calls is not List<object?> entries)
+                throw new ArgumentException("Malformed batch");
+
+            var results = new List<object?>();
+            foreach (object? entry in entries)
+            {
+                var result = new Dictionary<string, object?>();
+                try
+                {
+                    if (entry is not Dictionary<string, object?> call ||
+                        !call.TryGetValue("function", out object? name) || name is not string func)
+                        throw new ArgumentException("Malformed batch entry");
+
+                    methodIds.TryGetValue(func, out ushort methodId);
+                    result["result"] = FindMethod(methodId, func)(ParseDocumentArgs(clientId, call));
+                    result["status"] = 0;
+                }
+                catch (Exception ex)
+                {
+                    result["result"] = ex.Message;
+                    result["status"] = 1;
+                }
+                results.Add(result);
             }
+            return results;
+        }
+
+        private static byte[] EncodeResult(byte format, object? result)
+        {
+            if (format == WireFormat.Cbor || format == WireFormat.NativeJson)
+                return EncodeDocument(format, new Dictionary<string, object?> { ["result"] = result });
+            return Encoding.UTF8.GetBytes(JsonHelper.ToJson(result?.ToString() ?? ""));
+        }
+
+        private static byte[] EncodeDocument(byte format, object? document)
+        {
+#if !UNITY_2017_1_OR_NEWER
+            if (format == WireFormat.NativeJson)
+                return Encoding.UTF8.GetBytes(JsonHelper.ToNativeJson(document));
+#endif
+            return Cbor.Encode(document);
+        }
+
+        private static object? DecodeDocument(byte format, byte[] payload)
+        {
+#if !UNITY_2017_1_OR_NEWER
+            if (format == WireFormat.NativeJson)
+                return JsonHelper.FromNativeJson(Encoding.UTF8.GetString(payload));
+#endif
+            return Cbor.Decode(payload);
         }
 
-        private Dictionary<string, string> ParseArgs(string json)
+        // {"args":{...},"callbacks":[...]}
+        private Dictionary<string, object?> ParseDocumentArgs(int clientId, object? decoded)
         {
-            RpcArgsWrapper? parsed = JsonHelper.FromJson(json);
+            if (decoded is not Dictionary<string, object?> document)
+                throw new ArgumentException("Malformed arguments");
+
+            if (document.TryGetValue("callbacks", out object? callbacks) && callbacks is List<object?> ids)
+                RegisterCallbacks(clientId, ids.ConvertAll(id => Convert.ToInt64(id)).ToArray());
+
+            if (document.TryGetValue("args", out object? args) && args is Dictionary<string, object?> dict)
+                return dict;
+            return new Dictionary<string, object?>();
+        }
 
-            var dict = new Dictionary<string, string>();
+        // Callback IDs announced with a request carry the owning client ID in
+        // their upper 32 bits
+        private void RegisterCallbacks(int clientId, long[]? callbacks)
+        {
+            if (callbacks == null)
+                return;
+
+            respMutex.WaitOne();
+            foreach (long callbackId in callbacks)
+            {
+                if ((int)(callbackId >> 32) == clientId)
+                    callbackToClientId[callbackId] = clientId;
+            }
+            respMutex.ReleaseMutex();
+        }
+
+        private Dictionary<string, object?> ParseArgs(RpcArgsWrapper? parsed)
+        {
+            var dict = new Dictionary<string, object?>();
             for (int i = 0; i < parsed?.keys.Length; i++)
             {
                 dict[parsed.keys[i]] = parsed.values[i];
@@ -318,9 +691,13 @@ namespace SharedMemRPC
         {
             int size = Marshal.SizeOf<T>();
             byte[] buffer = new byte[size];
-            int read = stream.Read(buffer, 0, size);
-            if (read != size)
-                throw new IOException("Failed to read full header");
+            int readTotal = 0;
+            while (readTotal < size)
+            {
+                int read = stream.Read(buffer, readTotal, size - readTotal);
+                if (read <= 0) throw new IOException("Failed to read full header");
+                readTotal += read;
+            }
 
             GCHandle handle = GCHandle.Alloc(buffer, GCHandleType.Pinned);
             T header = Marshal.PtrToStructure<T>(handle.AddrOfPinnedObject());
@@ -328,7 +705,7 @@ namespace SharedMemRPC
             return header;
         }
 
-        private static string ReadPayload(NetworkStream stream, int size)
+        private static byte[] ReadPayload(NetworkStream stream, int size)
         {
             byte[] buffer = new byte[size];
             int readTotal = 0;
@@ -338,7 +715,7 @@ namespace SharedMemRPC
                 if (read <= 0) throw new IOException("Failed to read full payload");
                 readTotal += read;
             }
-            return Encoding.UTF8.GetString(buffer);
+            return buffer;
         }
 
         private static void WriteHeader<T>(NetworkStream stream, T header) where T : struct
@@ -351,10 +728,9 @@ namespace SharedMemRPC
             stream.Write(buffer, 0, size);
         }
 
-        private static void WritePayload(NetworkStream stream, string data)
+        private static void WritePayload(NetworkStream stream, byte[] data)
         {
-            byte[] buffer = Encoding.UTF8.GetBytes(data);
-            stream.Write(buffer, 0, buffer.Length);
+            stream.Write(data, 0, data.Length);
         }
 
         private static void DebugPrint(string message)
@@ -0,0 +1,727 @@
+#include "CallbackPool.h"
+#include "RpcClient.h"
+#include "RpcCodec.h"
+#include "RpcLog.h"
+#include "RpcServer.h"
+#include "ShmRing.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Tests for the client library and the native server, run by ctest. The
+// loopback case drives RpcClient over a LoopbackTransport against a scripted
+// server that checks every frame on the wire. Most others start an RpcServer
+// in this process and connect over the given transport, TCP by default.
+// RpcClient is one per process, so every case is its own run:
+//
+//   rpcTest <case> [tcp|unix|shm|uring-tcp|uring-unix]
+
+namespace
+{
+    using namespace std::chrono_literals;
+
+    constexpr int CLIENT_ID = 7;
+    constexpr int TEST_PORT = 7300;
+
+    // Exits at once: a failure may be on any thread, and the client singleton
+    // would otherwise outlive the server it talks to
+    [[noreturn]] void Finish(int status)
+    {
+        fflush(stdout);
+        fflush(stderr);
+        _exit(status);
+    }
+
+#define EXPECT(condition) do { if (!(condition)) \
+    { fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__, #condition); Finish(1); } } while (0)
+
+    struct Frame
+    {
+        int requestId = 0;
+        uint16_t methodId = 0;
+        uint8_t flags = 0;
+        std::string name;
+        std::string payload;
+    };
+
+    // Reads one request the way a server would; full headers until compact
+    Frame ReadFrame(LoopbackPipe& requests, bool compact)
+    {
+        Frame frame;
+        int bufferSize;
+        if (compact)
+        {
+            CompactRequestHeader header;
+            EXPECT(requests.Read(&header, sizeof(header)));
+            frame.requestId = header.requestId;
+            frame.methodId = header.methodId;
+            frame.flags = header.flags;
+            bufferSize = header.bufferSize;
+            frame.name.resize(header.nameLength);
+            EXPECT(requests.Read(frame.name.data(), frame.name.size()));
+        }
+        else
+        {
+            decltype(RpcRequest::header) header;
+            EXPECT(requests.Read(&header, sizeof(header)));
+            EXPECT(header.clientId == CLIENT_ID);
+            EXPECT(memchr(header.functionName, 0, sizeof(header.functionName)) != nullptr);
+            frame.requestId = header.requestId;
+            frame.flags = header.flags;
+            frame.name = header.functionName;
+            bufferSize = header.bufferSize;
+        }
+
+        EXPECT(bufferSize >= 0);
+        frame.payload.resize(bufferSize);
+        EXPECT(requests.Read(frame.payload.data(), frame.payload.size()));
+        return frame;
+    }
+
+    void Reply(LoopbackPipe& responses, const Frame& frame, nlohmann::json result, int status = 0, uint16_t methodId = 0)
+    {
+        WireFormat format = GetWireFormat(frame.flags);
+        std::string payload = format == WireFormat::JSON
+            ? nlohmann::json{{"result", result.is_string() ? result.get<std::string>() : result.dump()}}.dump()
+            : EncodePayload(format, {{"result", std::move(result)}});
+
+        ResponseHeader header{};
+        header.clientId = CLIENT_ID;
+        header.requestId = frame.requestId;
+        header.msgType = ResponseHeader::MsgType::MSG_RETURN;
+        header.flags = uint8_t(format);
+        header.methodId = methodId;
+        header.u.statusCode = status;
+        header.bufferSize = int(payload.size());
+        responses.Write(&header, sizeof(header));
+        responses.Write(payload.data(), payload.size());
+    }
+
+    // Arguments of a MessagePack call
+    nlohmann::json Args(const Frame& frame)
+    {
+        EXPECT(GetWireFormat(frame.flags) == WireFormat::MessagePack);
+        nlohmann::json document = DecodePayload(WireFormat::MessagePack, frame.payload);
+        EXPECT(document.is_object() && document.contains("args"));
+        return document["args"];
+    }
+
+    // The handshake in full headers, then compact headers with method IDs,
+    // then two calls answered in the opposite order they were sent
+    void ScriptedServer(std::shared_ptr<LoopbackPipe> requests, std::shared_ptr<LoopbackPipe> responses)
+    {
+        ResponseHeader hello{};
+        hello.clientId = CLIENT_ID;
+        responses->Write(&hello, sizeof(hello));
+
+        // One round trip for the format and every feature. Loopback can't
+        // pass fds; refusing blobs keeps arrays of numbers.
+        Frame negotiate = ReadFrame(*requests, false);
+        EXPECT(negotiate.name == "_RPC::Negotiate");
+        EXPECT(GetWireFormat(negotiate.flags) == WireFormat::JSON);
+        nlohmann::json offer = nlohmann::json::parse(negotiate.payload);
+        EXPECT(offer["keys"] == nlohmann::json::array({ "formats", "features" }));
+        EXPECT(nlohmann::json::parse(offer["values"][1].get<std::string>()) ==
+            nlohmann::json::array({ RPC_FEATURE_COMPACT_HEADERS, RPC_FEATURE_BATCH, RPC_FEATURE_BLOBS }));
+        Reply(*responses, negotiate, {
+            { "format", WireFormatName(WireFormat::MessagePack) },
+            { "features", { RPC_FEATURE_COMPACT_HEADERS } }
+        });
+
+        // Resolved by name once, by ID after
+        Frame first = ReadFrame(*requests, true);
+        EXPECT(first.methodId == 0 && first.name == "add");
+        nlohmann::json args = Args(first);
+        EXPECT(args["a"] == 2 && args["b"] == 3);
+        Reply(*responses, first, 5, 0, 1);
+
+        Frame second = ReadFrame(*requests, true);
+        EXPECT(second.methodId == 1 && second.name.empty());
+        Reply(*responses, second, Args(second)["a"].get<int>() + Args(second)["b"].get<int>());
+
+        // A one-way call by name still takes a reply, for its method ID
+        Frame resolving = ReadFrame(*requests, true);
+        EXPECT(resolving.name == "note" && !(resolving.flags & RPC_FLAG_ONEWAY));
+        EXPECT(Args(resolving)["values"] == nlohmann::json::array({ 1.5, 2.5 }));
+        Reply(*responses, resolving, nullptr, 0, 2);
+
+        Frame sync = ReadFrame(*requests, true);
+        EXPECT(sync.methodId == 1);
+        Reply(*responses, sync, 0);
+
+        Frame oneway = ReadFrame(*requests, true);
+        EXPECT(oneway.methodId == 2 && (oneway.flags & RPC_FLAG_ONEWAY));
+
+        Frame slow = ReadFrame(*requests, true);
+        Frame fast = ReadFrame(*requests, true);
+        EXPECT(slow.name == "echo" && fast.requestId != slow.requestId);
+        Reply(*responses, fast, Args(fast)["text"]);
+        Reply(*responses, slow, Args(slow)["text"]);
+    }
+
+    void TestLoopback()
+    {
+        RpcClient& client = RpcClient::Get([]()
+        {
+            auto transport = std::make_unique<LoopbackTransport>();
+            std::thread(ScriptedServer, transport->ToServer(), transport->ToClient()).detach();
+            return transport;
+        });
+        EXPECT(client.GetClientId() == CLIENT_ID);
+
+        EXPECT(client.Call("add", {{"a", 2}, {"b", 3}}) == 5);
+        EXPECT(client.Call("add", {{"a", 4}, {"b", 5}}) == 9);
+
+        // Without blob support the blob goes as an array of numbers
+        std::vector<float> values = { 1.5f, 2.5f };
+        client.Notify("note", {{"values", RpcClient::Blob<float>(values)}});
+
+        // Its reply, and so its method ID, is in once a later call returns
+        client.Call("add", {{"a", 0}, {"b", 0}});
+        client.Notify("note", {{"values", RpcClient::Blob<float>(values)}});
+
+        // Replies are matched by request ID, whatever order they come in
+        auto slow = client.CallAsync("echo", {{"text", "slow"}});
+        auto fast = client.CallAsync("echo", {{"text", "fast"}});
+        EXPECT(fast.get() == "fast");
+        EXPECT(slow.get() == "slow");
+    }
+
+    const FunctionStats* FindStats(const std::vector<FunctionStats>& stats, const std::string& function)
+    {
+        for (const FunctionStats& entry : stats)
+        {
+            if (entry.function == function)
+                return &entry;
+        }
+        return nullptr;
+    }
+
+    // Lines of /proc/self/maps naming a file
+    int Mappings(const char* file)
+    {
+        int count = 0;
+        FILE* maps = fopen("/proc/self/maps", "r");
+        EXPECT(maps != nullptr);
+        char line[4096];
+        while (fgets(line, sizeof(line), maps))
+            count += strstr(line, file) != nullptr;
+        fclose(maps);
+        return count;
+    }
+
+    // A native server with the functions the cases call. Never destroyed:
+    // cases end in Finish with the client still connected.
+    RpcServer& StartServer(int port)
+    {
+        RpcServer& server = *new RpcServer(port, 4);
+        server.Register<double(double, double)>("add", [](double a, double b) { return a + b; }, "a", "b");
+        server.Register<std::string(std::string)>("echo", [](std::string text) { return text; }, "text");
+        server.Register<int(int64_t, int)>("call_back", [&server](int64_t callback, int count)
+        {
+            for (int i = 0; i < count; ++i)
+                server.TriggerCallback(callback, {{ "index", i }});
+            return count;
+        }, "callback", "count");
+
+        server.Register<double(std::span<const float>)>("sum", [](std::span<const float> values)
+        {
+            return std::accumulate(values.begin(), values.end(), 0.0);
+        }, "values");
+        server.Register("blob_shape", RpcServer::BlobHandler([](const nlohmann::json&, const RpcBlobs& blobs)
+        {
+            auto blob = blobs.find("values");
+            return blob != blobs.end() ? nlohmann::json(blob->second.shape) : nlohmann::json();
+        }));
+
+        server.Register<int(std::string)>("payload_mappings", [](std::string) { return Mappings("memfd:rpc-payload"); }, "text");
+
+        static std::atomic_int notes{0};
+        server.Register<void(int)>("note", [](int value) { notes += value; }, "value");
+        server.Register<int()>("notes", []() { return notes.load(); });
+        server.Register<int(int)>("sleep", [](int ms)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+            return ms;
+        }, "ms");
+        server.Start();
+        return server;
+    }
+
+    RpcClient& Connect(TransportType type, int port)
+    {
+        StartServer(port);
+        return RpcClient::Get(port, false, type);
+    }
+
+    // Frames of every size make it through the transport intact
+    void TestCalls(TransportType type, int port)
+    {
+        RpcClient& client = Connect(type, port);
+
+        // Resolved by name the first time, by method ID after
+        EXPECT(client.Call("add", {{"a", 1.5}, {"b", 2}}) == 3.5);
+        EXPECT(client.Call("add", {{"a", 2.5}, {"b", 2}}) == 4.5);
+
+        client.Call("missing");
+        EXPECT(FindStats(client.GetStats(), "missing")->errors == 1);
+
+        // Small, bigger than a socket buffer, and past the memfd threshold
+        for (size_t size : { size_t(64), size_t(100 * 1024), size_t(3 * 1024 * 1024) })
+        {
+            std::string text(size, 'x');
+            for (size_t i = 0; i < size; i += 4099)
+                text[i] = char('a' + i % 26);
+            EXPECT(client.Call("echo", {{"text", text}}) == text);
+        }
+    }
+
+    // Stop runs everything posted before it, overflow included
+    void TestCallbackPool(TransportType, int)
+    {
+        CallbackPool pool("[Test]", 4);
+        pool.Start(1);
+
+        // The first task holds the worker until four more fill the queue and
+        // the rest overflow. The first overflowed one holds it again, with
+        // the queue empty, until Stop has posted.
+        std::promise<void> queueFull, stopping;
+        std::shared_future<void> queueFullFuture = queueFull.get_future().share();
+        std::shared_future<void> stoppingFuture = stopping.get_future().share();
+        std::atomic_int ran{0};
+        pool.Post([&]() { queueFullFuture.wait(); ++ran; });
+        pool.Post([]() { throw std::runtime_error("Ignored"); });
+        for (int i = 0; i < 3; ++i)
+            pool.Post([&]() { ++ran; });
+        pool.Post([&]() { stoppingFuture.wait(); ++ran; });
+        for (int i = 0; i < 10; ++i)
+            pool.Post([&]() { ++ran; });
+
+        queueFull.set_value();
+        while (ran < 4)
+            std::this_thread::yield();
+
+        std::thread stopper([&]() { pool.Stop(); });
+        std::this_thread::sleep_for(50ms);
+        stopping.set_value();
+        stopper.join();
+        EXPECT(ran == 15);
+    }
+
+    // Waiting callers block rather than spin, and none misses its wakeup
+    // whatever the spin limit
+    void TestSpinLimit(TransportType type, int port)
+    {
+        RpcClient& client = Connect(type, port);
+
+        for (int limit : { 0, 1 << 20 })
+        {
+            client.SetSpinLimit(limit);
+            std::vector<std::thread> callers;
+            for (int t = 0; t < 8; ++t)
+            {
+                callers.emplace_back([&client, t]()
+                {
+                    for (int i = 0; i < 500; ++i)
+                        EXPECT(client.Call("add", {{"a", t}, {"b", i}}) == t + i);
+                });
+            }
+            for (std::thread& caller : callers)
+                caller.join();
+        }
+
+        // Callers waiting out slow calls, which the server runs one after
+        // another, take next to no CPU
+        std::clock_t start = std::clock();
+        std::vector<std::thread> sleepers;
+        for (int t = 0; t < 8; ++t)
+            sleepers.emplace_back([&client]() { EXPECT(client.Call("sleep", {{"ms", 50}}) == 50); });
+        for (std::thread& sleeper : sleepers)
+            sleeper.join();
+        EXPECT(std::clock() - start < CLOCKS_PER_SEC / 10);
+    }
+
+    // Bound stubs encode their arguments and decode typed results; failures throw
+    void TestBind(TransportType type, int port)
+    {
+        RpcClient& client = Connect(type, port);
+
+        auto add = client.Bind<double(double, double)>("add", "a", "b");
+        EXPECT(add(5, 2.5) == 7.5);
+        EXPECT(add(-1, 1) == 0);
+
+        auto echo = client.Bind<std::string(std::string)>("echo", "text");
+        EXPECT(echo("bound") == "bound");
+
+        auto note = client.Bind<void(int)>("note", "value");
+        note(3);
+        EXPECT(client.Bind<int()>("notes")() == 3);
+
+        auto expectThrow = [](auto&& call)
+        {
+            bool threw = false;
+            try
+            {
+                call();
+            }
+            catch (const std::runtime_error&)
+            {
+                threw = true;
+            }
+            EXPECT(threw);
+        };
+        expectThrow([&]() { client.Bind<double(double, double)>("missing", "a", "b")(1, 2); });
+        expectThrow([&]() { client.Bind<double(std::string)>("echo", "text")("not a number"); });
+    }
+
+    // One-way calls run but get no reply once their method ID is known;
+    // the first, sent by name, is answered with the ID
+    void TestOneway(TransportType type, int port)
+    {
+        RpcClient& client = Connect(type, port);
+
+        client.Notify("note", {{"value", 1}});
+        EXPECT(client.Call("notes") == 1);
+        uint64_t received = FindStats(client.GetStats(), "note")->bytesReceived;
+        EXPECT(received > 0);
+
+        for (int i = 0; i < 1000; ++i)
+            client.Notify("note", {{"value", 1}});
+        EXPECT(client.Call("notes") == 1001);
+
+        std::vector<FunctionStats> stats = client.GetStats();
+        EXPECT(FindStats(stats, "note")->calls == 1001);
+        EXPECT(FindStats(stats, "note")->bytesReceived == received);
+    }
+
+    // Trace statements are compiled out, in the libraries too, arguments
+    // and all; the rest are filtered by the runtime level
+    void TestLogging(TransportType type, int port)
+    {
+        static std::mutex linesMutex;
+        static std::vector<std::pair<LogLevel, std::string>> lines;
+        RpcLog::SetSink([](LogLevel level, const std::string& text)
+        {
+            std::lock_guard<std::mutex> linesLock(linesMutex);
+            lines.emplace_back(level, text);
+        });
+        auto logged = [](LogLevel level, const char* text)
+        {
+            std::lock_guard<std::mutex> linesLock(linesMutex);
+            return std::count_if(lines.begin(), lines.end(), [&](const auto& line)
+            {
+                return line.first == level && line.second.find(text) != std::string::npos;
+            });
+        };
+
+        RpcLog::SetLevel(LogLevel::Trace);
+        int evaluated = 0;
+        RPC_LOG_TRACE("Trace %d", ++evaluated);
+        EXPECT(evaluated == 0 && logged(LogLevel::Trace, "Trace") == 0);
+
+        RpcClient& client = Connect(type, port);
+        EXPECT(client.Call("add", {{"a", 1}, {"b", 2}}) == 3);
+        EXPECT(logged(LogLevel::Debug, "Client ID") == 1);
+        EXPECT(logged(LogLevel::Trace, "add") == 0);
+
+        // Failed calls are logged at Debug by the server
+        RpcLog::SetLevel(LogLevel::Info);
+        client.Call("missing");
+        RPC_LOG_DEBUG("Debug %d", ++evaluated);
+        EXPECT(evaluated == 0 && logged(LogLevel::Debug, "missing") == 0);
+
+        RpcLog::SetLevel(LogLevel::Debug);
+        client.Call("missing");
+        RPC_LOG_DEBUG("Debug %d", ++evaluated);
+        EXPECT(evaluated == 1 && logged(LogLevel::Debug, "missing") == 1);
+    }
+
+    // Large payloads come as memfds the server maps, only from transports
+    // that pass fds: plain Unix sockets
+    void TestMemfd(TransportType type, int port)
+    {
+        RpcClient& client = Connect(type, port);
+        bool local = type == TransportType::Unix;
+
+        EXPECT(client.Call("payload_mappings", {{"text", std::string(1024, 'm')}}) == 0);
+        EXPECT(client.Call("payload_mappings", {{"text", std::string(1024 * 1024, 'm')}}) == (local ? 1 : 0));
+
+        // Unmapped once the request is done
+        EXPECT(client.Call("payload_mappings", {{"text", "small"}}) == 0);
+    }
+
+    // Callbacks may make blocking calls, even with more of them in flight
+    // than the callback queue holds
+    void TestCallbacks(TransportType type, int port)
+    {
+        RpcClient& client = Connect(type, port);
+        client.SetCallbackThreads(1);
+
+        constexpr int COUNT = 3000;
+        std::atomic_int done{0};
+        std::promise<void> finished;
+        EXPECT(client.Call("call_back", {{"count", COUNT}}, {{"callback", [&](const nlohmann::json& args)
+        {
+            int index = args["index"].get<int>();
+            EXPECT(client.Call("add", {{"a", index}, {"b", 1}}) == index + 1);
+            if (++done == COUNT)
+                finished.set_value();
+        }}}) == COUNT);
+        EXPECT(finished.get_future().wait_for(30s) == std::future_status::ready);
+    }
+
+    // A connection's requests run in the order they were sent
+    void TestOrdering(TransportType type, int port)
+    {
+        RpcClient& client = Connect(type, port);
+
+        for (int i = 0; i < 100; ++i)
+            client.Notify("note", {{"value", 1}});
+        EXPECT(client.Call("notes") == 100);
+
+        // The slow call's reply goes out, and is taken in, before the quick one's
+        auto slow = client.CallAsync("sleep", {{"ms", 100}});
+        auto quick = client.CallAsync("add", {{"a", 1}, {"b", 1}});
+        EXPECT(quick.get() == 2.0);
+        EXPECT(slow.wait_for(0s) == std::future_status::ready && slow.get() == 100);
+    }
+
+    // The format and every feature are agreed in one round trip
+    void TestNegotiate(TransportType type, int port)
+    {
+        RpcClient& client = Connect(type, port);
+        EXPECT(client.Call("add", {{"a", 1}, {"b", 2}}) == 3);
+
+        std::vector<FunctionStats> stats = client.GetStats();
+        int internal = 0;
+        for (const FunctionStats& entry : stats)
+            internal += entry.function.starts_with("_RPC::");
+        EXPECT(internal == 1 && FindStats(stats, "_RPC::Negotiate")->calls == 1);
+
+        // Formats alone, the way older clients ask, get the format's name
+        EXPECT(client.Negotiate({ WireFormat::CBOR }) == WireFormat::CBOR);
+        EXPECT(client.Call("echo", {{"text", "cbor"}}) == "cbor");
+    }
+
+    // A batch goes as one _RPC::Batch request once negotiated, and an
+    // entry that fails leaves the others be
+    void TestBatch(TransportType type, int port)
+    {
+        RpcClient& client = Connect(type, port);
+
+        std::atomic_int called{0};
+        std::vector<RpcClient::BatchEntry> entries = {
+            { "add", {{"a", 1}, {"b", 2}} },
+            { "missing", {} },
+            { "call_back", {{"count", 3}}, {{"callback", [&](const nlohmann::json&) { ++called; }}} },
+            { "echo", {{"text", "last"}} },
+        };
+        std::vector<RpcClient::BatchResult> results = client.CallBatch(entries);
+        EXPECT(results.size() == 4);
+        EXPECT(results[0].statusCode == 0 && results[0].result == 3);
+        EXPECT(results[1].statusCode != 0 && results[1].result.is_string());
+        EXPECT(results[2].statusCode == 0 && results[2].result == 3);
+        EXPECT(results[3].statusCode == 0 && results[3].result == "last");
+
+        std::vector<FunctionStats> stats = client.GetStats();
+        EXPECT(FindStats(stats, "_RPC::Batch")->calls == 1);
+        EXPECT(FindStats(stats, "add") == nullptr && FindStats(stats, "missing") == nullptr);
+
+        // Sent before the batch's reply, and run on the callback threads
+        while (called < 3)
+            std::this_thread::yield();
+    }
+
+    // Blob arguments reach the server as raw bytes, with their shape, in
+    // single calls and in batches
+    void TestBlobs(TransportType type, int port)
+    {
+        RpcClient& client = Connect(type, port);
+
+        std::vector<float> values(1024 * 64);
+        std::iota(values.begin(), values.end(), 0.0f);
+        double expected = std::accumulate(values.begin(), values.end(), 0.0);
+        RpcClient::Blob<float> blob(values, { 1024, 64 });
+
+        EXPECT(client.Call("sum", {{"values", blob}}) == expected);
+        EXPECT(client.Call("blob_shape", {{"values", blob}}) == nlohmann::json::array({ 1024, 64 }));
+
+        std::vector<RpcClient::BatchEntry> entries = {
+            { "sum", {{"values", blob}} },
+            { "blob_shape", {{"values", RpcClient::Blob<float>(std::span(values).first(6), { 2, 3 })}} },
+        };
+        std::vector<RpcClient::BatchResult> results = client.CallBatch(entries);
+        EXPECT(results[0].statusCode == 0 && results[0].result == expected);
+        EXPECT(results[1].statusCode == 0 && results[1].result == nlohmann::json::array({ 2, 3 }));
+    }
+
+    // Runs to completion on its own; nothing waits on its handle
+    struct Detached
+    {
+        struct promise_type
+        {
+            Detached get_return_object() { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    Detached CountUp(RpcClient& client, int steps, std::promise<double>& done)
+    {
+        // Awaiters are made first: GCC 12 can't take braced arguments
+        // inside co_await
+        auto first = client.CallCo("add", {{"a", 0}, {"b", 1}});
+        nlohmann::json sum = co_await first;
+        for (int i = 1; i < steps; ++i)
+        {
+            auto next = client.CallCo("add", {{"a", sum}, {"b", 1}});
+            sum = co_await next;
+        }
+        done.set_value(sum.get<double>());
+    }
+
+    // Coroutines chain calls, each resumed through the resume executor
+    void TestCoroutine(TransportType type, int port)
+    {
+        RpcClient& client = Connect(type, port);
+
+        std::atomic_int resumed{0};
+        client.SetResumeExecutor([&](std::function<void()> resume)
+        {
+            ++resumed;
+            resume();
+        });
+
+        std::promise<double> done;
+        CountUp(client, 20, done);
+        EXPECT(done.get_future().get() == 20);
+        EXPECT(resumed == 20);
+    }
+
+    // Starts of the shared-memory segments mapped in this process
+    std::vector<ShmSegment*> SharedSegments()
+    {
+        std::vector<ShmSegment*> segments;
+        FILE* maps = fopen("/proc/self/maps", "r");
+        EXPECT(maps != nullptr);
+        char line[4096];
+        while (fgets(line, sizeof(line), maps))
+        {
+            if (strstr(line, "/SharedMemRPC."))
+                segments.push_back(reinterpret_cast<ShmSegment*>(strtoull(line, nullptr, 16)));
+        }
+        fclose(maps);
+        return segments;
+    }
+
+    // The server attaches the client's segment, and keeps to the ring
+    // geometry it checked then even if the client rewrites it
+    void TestSharedMemory(TransportType, int port)
+    {
+        RpcClient& client = Connect(TransportType::SharedMemory, port);
+
+        // The client unmaps its segment if the server didn't attach, so
+        // client and server each hold one on success
+        std::vector<ShmSegment*> segments = SharedSegments();
+        EXPECT(segments.size() == 2);
+
+        for (ShmRing* ring : { &segments[0]->requestRing, &segments[0]->responseRing })
+        {
+            ring->capacity = 1u << 31;
+            ring->dataOffset = uint64_t(1) << 40;
+        }
+
+        std::string text(3 * SHM_RING_CAPACITY, 's');
+        EXPECT(client.Call("echo", {{"text", text}}) == text);
+    }
+
+    struct Transport
+    {
+        const char* name;
+        TransportType type;
+    };
+
+    const Transport TRANSPORTS[] = {
+        { "tcp", TransportType::TCP },
+        { "unix", TransportType::Unix },
+        { "shm", TransportType::SharedMemory },
+        { "uring-tcp", TransportType::UringTCP },
+        { "uring-unix", TransportType::UringUnix },
+    };
+
+    // Cases that need no server ignore the transport
+    struct Case
+    {
+        const char* name;
+        void (*run)(TransportType type, int port);
+    };
+
+    const Case CASES[] = {
+        { "loopback", [](TransportType, int) { TestLoopback(); } },
+        { "calls", TestCalls },
+        { "spin-limit", TestSpinLimit },
+        { "bind", TestBind },
+        { "oneway", TestOneway },
+        { "logging", TestLogging },
+        { "memfd", TestMemfd },
+        { "callback-pool", TestCallbackPool },
+        { "callbacks", TestCallbacks },
+        { "ordering", TestOrdering },
+        { "shm", TestSharedMemory },
+        { "negotiate", TestNegotiate },
+        { "batch", TestBatch },
+        { "coroutine", TestCoroutine },
+        { "blobs", TestBlobs },
+    };
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2 || argc > 3)
+    {
+        fprintf(stderr, "Usage: rpcTest <case> [tcp|unix|shm|uring-tcp|uring-unix]\n");
+        return 2;
+    }
+
+    RpcLog::SetLevel(LogLevel::Warning);
+
+    size_t transport = 0;
+    while (argc == 3 && transport < std::size(TRANSPORTS) && strcmp(argv[2], TRANSPORTS[transport].name) != 0)
+        ++transport;
+    if (transport == std::size(TRANSPORTS))
+    {
+        fprintf(stderr, "Unknown transport %s\n", argv[2]);
+        return 2;
+    }
+
+    for (size_t i = 0; i < std::size(CASES); ++i)
+    {
+        if (strcmp(argv[1], CASES[i].name) != 0)
+            continue;
+
+        // A port per case and transport, so ctest can run them in parallel
+        CASES[i].run(TRANSPORTS[transport].type, TEST_PORT + int(i * std::size(TRANSPORTS) + transport));
+        printf("%s passed\n", argv[1]);
+        Finish(0);
+    }
+
+    fprintf(stderr, "Unknown case %s\n", argv[1]);
+    return 2;
+}